@@ -0,0 +1,139 @@
+#ifndef ARCHIVE_FORMAT_H
+#define ARCHIVE_FORMAT_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace huffman {
+
+// archives without this prefix are in the original format: symbol count, alphabet power and
+// a (symbol, frequency) pair per symbol
+constexpr std::array<char, 4> kArchiveMagic = {'H', 'F', 'Z', '\x02'};
+constexpr std::array<char, 4> kIndexMagic = {'H', 'F', 'Z', 'I'};
+// index whose entries also name the block holding the code table in effect, see block_index_entry
+constexpr std::array<char, 4> kTableIndexMagic = {'H', 'F', 'Z', 'T'};
+// single-block archives written with a shared table, small messages can't carry the index and trailer
+constexpr std::array<char, 4> kMessageMagic = {'H', 'F', 'Z', '\x03'};
+
+// archive layout:
+//   magic, u32 block size
+//   block records: u8 type, u32 raw size, u32 payload size, payload
+//   end record: a single u8 block_type::end
+//   block index: u32 block count, u64 original file size, block_index_entry per block, then optionally
+//   seek points: u32 seek interval, then per block a u32 point count and the u64 points
+//   trailer: u64 offset of the block index, table index magic (index magic for indexes written without
+//   table blocks, which are read by scanning back for the table)
+// message layout: message magic, then a single block record and nothing after it
+enum class block_type : uint8_t {
+    end = 0,
+    huffman = 1,  // code lengths header followed by the canonical bitstream
+    stored = 2,   // raw bytes
+    // code lengths header, u8 stream count, u32 size of every stream but the last, then the streams.
+    // the block is cut into that many equal segments, the last one shorter, each with its own bitstream
+    interleaved = 3,
+    // u32 dictionary id followed by the bitstream, the code table is the dictionary's
+    dictionary = 4,
+    // stream count, u32 size of every stream but the last, then the streams. the code table is the one
+    // of the nearest earlier huffman or interleaved block
+    repeat = 5,
+    // a single u8 symbol that fills the whole block
+    run = 6,
+    // u8 symbol count, the symbols in increasing order, then the index of every byte into them at a fixed
+    // width, msb-first: 1 bit for two symbols, 2 bits for three or four
+    packed = 7,
+    // u8 table count, the table of every previous byte as 4-bit entries (byte 0's in the high half of the
+    // first), a code lengths header per table, then a single bitstream in which every byte is coded with
+    // the table its previous byte selects. the first byte of the block takes byte 0's
+    context = 8,
+    // u8 mask of the tables present, u32 sequence count, u32 literal count, code lengths headers of the
+    // literal, literal run, match length and distance tables present, u32 literal stream size, the literal
+    // bitstream, then a bitstream with every sequence's literal run, match length and, for a non-zero match
+    // length, distance. those are value codes: values below 16 are their own code, a larger one takes code
+    // 12 + the position of its top bit and is followed by the bits below that bit
+    lz = 9,
+};
+
+constexpr size_t kArchiveHeaderSize = kArchiveMagic.size() + sizeof(uint32_t);
+constexpr size_t kMessageHeaderSize = kMessageMagic.size();
+constexpr size_t kBlockHeaderSize = sizeof(uint8_t) + 2 * sizeof(uint32_t);
+constexpr size_t kTrailerSize = sizeof(uint64_t) + kIndexMagic.size();
+
+constexpr int kMaxStreams = 8;
+constexpr int kMaxPackedAlphabet = 4;
+constexpr int kMaxContextTables = 16;
+constexpr size_t kContextMapSize = 256 / 2;
+constexpr int kLzTables = 4;
+
+constexpr size_t kMinBlockSize = size_t(1) << 10;
+constexpr size_t kMaxBlockSize = size_t(1) << 30;
+constexpr size_t kDefaultBlockSize = size_t(1) << 20;
+
+struct block_header {
+    block_type type;
+    uint32_t raw_size;
+    uint32_t payload_size;
+};
+
+constexpr uint32_t kNoTableBlock = UINT32_MAX;
+
+struct block_index_entry {
+    uint64_t compressed_offset;    // offset of the block record from the start of the archive
+    uint64_t uncompressed_offset;  // offset of the first block byte in the original file
+    uint64_t bit_length;           // encoded bits in the payload, without the code table and padding
+    // the nearest huffman or interleaved block up to this one, whose table a repeat block after it takes.
+    // kNoTableBlock when there's none
+    uint32_t table_block = kNoTableBlock;
+};
+
+constexpr size_t kBlockIndexEntrySize = 3 * sizeof(uint64_t) + sizeof(uint32_t);
+// entries of an index with the index magic
+constexpr size_t kBlockIndexEntrySizeWithoutTables = 3 * sizeof(uint64_t);
+
+// seek point k of a block sits at output offset (k + 1) * interval inside it and holds the bit offset of
+// that symbol in the bitstream that codes it, counted from the start of that stream.
+// only blocks decoded through a bitstream of per-byte codes have them: huffman, interleaved, dictionary
+// and repeat blocks
+constexpr size_t kMinSeekInterval = size_t(1) << 10;
+
+struct block_index {
+    std::vector<block_index_entry> entries;
+    uint64_t raw_size;    // size of the original file
+    uint64_t blocks_end;  // offset of the end record
+    bool has_table_blocks = false;                   // false for indexes that predate table blocks
+    uint32_t seek_interval = 0;                      // zero when the archive has no seek points
+    std::vector<std::vector<uint64_t>> seek_points;  // per block, when seek_interval isn't zero
+
+    // offset right past the record of the given block
+    [[nodiscard]] uint64_t get_compressed_end(size_t block) const;
+    [[nodiscard]] uint64_t get_raw_size(size_t block) const;
+};
+
+// parses the header of a block record, throws if it or its payload runs past size
+block_header parse_block_header(const uint8_t* data, size_t size);
+
+// code lengths header: alphabet power - 1, bits per length, the symbols (as a list for small
+// alphabets, as a 256-bit map otherwise), then the lengths of those symbols bit-packed in symbol order
+void pack_code_lengths(const std::array<uint8_t, 256>& lengths, std::vector<uint8_t>& output);
+
+// largest packed code lengths header: every symbol in the bitmap, 6 bits for lengths up to 32
+constexpr size_t kMaxPackedCodeLengthsSize = 2 + 256 / 8 + 256 * 6 / 8;
+
+// most a payload can exceed its raw size by: a table header of the largest size, a full stream table and a
+// partial byte per stream. no other block type is chosen over stored bytes when it's larger
+constexpr size_t kMaxBlockOverhead = kMaxPackedCodeLengthsSize + 1 + (kMaxStreams - 1) * sizeof(uint32_t) + kMaxStreams;
+
+// size of a packed code lengths header, computed from its first two bytes
+size_t packed_code_lengths_size(const uint8_t* prefix);
+// size the header of lengths packs into
+size_t packed_code_lengths_size(const std::array<uint8_t, 256>& lengths);
+// smallest header a code over that many symbols can pack into
+size_t min_packed_code_lengths_size(int alphabet_power);
+
+// throws on a malformed header, returns the number of bytes consumed
+size_t unpack_code_lengths(const uint8_t* data, size_t size, std::array<uint8_t, 256>& lengths);
+
+}  // namespace huffman
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef BIT_STREAM_H
+#define BIT_STREAM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace huffman {
+
+// code of one symbol, msb-first in the low length bits
+struct huffman_code {
+    uint32_t bits;
+    uint8_t length;
+};
+
+// reads a msb-first bitstream through a 64-bit register, the first unread bit is the top bit of buffer_
+class bit_reader {
+public:
+    bit_reader() : bit_reader(nullptr, 0) {}
+    bit_reader(const uint8_t* data, size_t size) : data_(data), size_(size), position_(0), buffer_(0), bits_(0) {}
+
+    // tops the register up to at least 56 valid bits, past the end of data zero bits are shifted in
+    void refill() {
+        if (position_ + 8 <= size_) {
+            uint64_t word;
+            std::memcpy(&word, data_ + position_, sizeof(word));
+            buffer_ |= __builtin_bswap64(word) >> bits_;
+            position_ += (63 - bits_) >> 3;
+            bits_ |= 56;
+            return;
+        }
+        while (bits_ <= 56) {
+            uint64_t byte = position_ < size_ ? data_[position_] : 0;
+            buffer_ |= byte << (56 - bits_);
+            position_ += 1;
+            bits_ += 8;
+        }
+    }
+
+    [[nodiscard]] uint32_t peek(int count) const { return static_cast<uint32_t>(buffer_ >> (64 - count)); }
+
+    void consume(int count) {
+        buffer_ <<= count;
+        bits_ -= count;
+    }
+
+    [[nodiscard]] uint64_t get_buffer() const { return buffer_; }
+    [[nodiscard]] int get_available_bits() const { return bits_; }
+
+    // number of bits taken from the stream so far, including zero padding past the end
+    [[nodiscard]] size_t get_consumed_bits() const { return position_ * 8 - bits_; }
+
+private:
+    const uint8_t* data_;
+    size_t size_;
+    size_t position_;
+    uint64_t buffer_;
+    int bits_;
+};
+
+// writes a msb-first bitstream through a 64-bit register that is flushed a whole word at a time,
+// so the destination needs 8 bytes of slack past the last byte of the stream
+class bit_writer {
+public:
+    explicit bit_writer(uint8_t* output) : output_(output), position_(0), buffer_(0), bits_(0) {}
+
+    // pending bits and the code together must fit the register, a flush leaves at most 7 bits pending
+    void put(huffman_code code) {
+        buffer_ |= uint64_t(code.bits) << (64 - bits_ - code.length);
+        bits_ += code.length;
+    }
+
+    // stores the register and moves past every completed byte
+    void flush() {
+        uint64_t word = __builtin_bswap64(buffer_);
+        std::memcpy(output_ + position_, &word, sizeof(word));
+        position_ += bits_ >> 3;
+        buffer_ = (bits_ & ~7) == 64 ? 0 : buffer_ << (bits_ & ~7);
+        bits_ &= 7;
+    }
+
+    // flushes and returns the stream size in bytes, the last byte padded with zero bits
+    size_t finish() {
+        flush();
+        return position_ + (bits_ != 0);
+    }
+
+private:
+    uint8_t* output_;
+    size_t position_;
+    uint64_t buffer_;
+    int bits_;
+};
+
+}  // namespace huffman
+
+#endif
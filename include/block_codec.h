@@ -0,0 +1,169 @@
+#ifndef BLOCK_CODEC_H
+#define BLOCK_CODEC_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "archive_format.h"
+#include "bit_stream.h"
+#include "decode_table.h"
+#include "dictionary.h"
+#include "histogram.h"
+#include "lz_matcher.h"
+
+namespace huffman {
+
+// code length of every byte value, zero for bytes without a code
+using code_lengths = std::array<uint8_t, 256>;
+
+struct encoded_block {
+    block_type type;
+    uint32_t raw_size;
+    std::vector<uint8_t> payload;
+    size_t metadata_size;  // leading payload bytes taken by the code table
+    uint64_t bit_length;   // encoded bits following the code table
+    std::vector<uint64_t> seek_points;  // see block_index, empty unless asked for
+};
+
+// longest code length the encoder may emit by default, with it every code resolves in the
+// decoder's primary table
+constexpr int kDefaultMaxCodeLength = 11;
+// 2^8 codes are needed to cover the byte alphabet
+constexpr int kMinCodeLengthLimit = 8;
+constexpr int kMaxCodeLengthLimit = 32;
+
+// number of bits data takes once encoded with codes
+uint64_t count_encoded_bits(const histogram& counts, const std::array<huffman_code, 256>& codes);
+
+// packs the codes of data into output, which needs room for the encoded bits plus 8 bytes of slack.
+// codes must not exceed max_length bits, max_length must not exceed 32. returns the bytes written
+size_t encode_bits(
+    const uint8_t* data,
+    size_t size,
+    const std::array<huffman_code, 256>& codes,
+    int max_length,
+    uint8_t* output
+);
+
+// what a block is encoded with, decided from its histogram before any bits are written
+struct block_plan {
+    block_type type;
+    histogram counts;
+    code_lengths lengths;  // lengths of the table the block is encoded with
+    uint64_t bit_length;
+    size_t size;  // payload size, estimated with every stream ending in a partial byte
+
+    // context blocks: the table of every previous byte, and the lengths of those tables
+    std::array<uint8_t, 256> context_tables;
+    std::vector<code_lengths> context_lengths;
+
+    // lz blocks: the sequences, and the lengths of the literal, literal run, match length and distance tables
+    std::vector<lz_sequence> sequences;
+    std::array<code_lengths, kLzTables> lz_lengths;
+};
+
+// counts the block and builds its own code lengths. a block of one symbol becomes a run, one the code
+// wouldn't shrink is stored raw, which its entropy mostly tells before any code is built. up to
+// kMaxPackedAlphabet symbols are packed at a fixed width when that's no larger than the code
+block_plan plan_block(const uint8_t* data, size_t size, int max_code_length, int streams);
+// plan_block in two steps: the histogram alone, then the choice of table from it. given the previous
+// block's lengths, plan_table takes them as a repeat block without building a code when the block's own
+// table couldn't be smaller, otherwise it plans as plan_block does and leaves the repeat to choose_table
+block_plan count_block(const uint8_t* data, size_t size);
+void plan_table(
+    block_plan& plan,
+    size_t size,
+    int max_code_length,
+    int streams,
+    const code_lengths* previous_lengths = nullptr
+);
+// switches the plan to a context block when coding every byte with a table picked by the byte before it
+// makes a smaller payload. the 256 contexts are clustered into at most kMaxContextTables tables
+void choose_context_model(block_plan& plan, const uint8_t* data, size_t size, int max_code_length);
+// switches the plan to an lz block when the matches found at level (1 to kMaxLzLevel), with the literals
+// left between them, make a smaller payload coded with tables of their own
+void choose_lz(block_plan& plan, const uint8_t* data, size_t size, int level, int max_code_length);
+// switches the plan to the dictionary or to the previous block's table when one of them makes a payload
+// no larger than the block's own table, so a block that looks like the one before skips its code table
+void choose_table(
+    block_plan& plan,
+    int streams,
+    const dictionary* shared_table,
+    const code_lengths* previous_lengths
+);
+// a non-zero seek interval records the block's seek points along with it
+void encode_planned(
+    const uint8_t* data,
+    size_t size,
+    const block_plan& plan,
+    int streams,
+    const dictionary* shared_table,
+    encoded_block& block,
+    uint32_t seek_interval = 0
+);
+
+// compresses one block on its own: histogram and canonical codes all come from this block only,
+// no code is longer than max_code_length. more than one stream gives an interleaved block.
+// with a dictionary the block takes its table instead whenever that makes the block no larger
+encoded_block encode_block(
+    const uint8_t* data,
+    size_t size,
+    int max_code_length,
+    int streams = 1,
+    const dictionary* shared_table = nullptr
+);
+// same, into block, whose payload storage is reused
+void encode_block(
+    const uint8_t* data,
+    size_t size,
+    int max_code_length,
+    int streams,
+    encoded_block& block,
+    const dictionary* shared_table = nullptr
+);
+
+// decodes a block payload into exactly raw_size bytes of output, throws on corrupted data.
+// returns the number of leading payload bytes taken by the code table
+size_t decode_block(block_type type, const uint8_t* payload, size_t payload_size, char* output, size_t raw_size);
+// same, building the code table in table, whose storage is reused. dictionary blocks need the
+// dictionary they were encoded with, repeat blocks the code lengths read_code_lengths last returned
+size_t decode_block(
+    block_type type,
+    const uint8_t* payload,
+    size_t payload_size,
+    char* output,
+    size_t raw_size,
+    decode_table& table,
+    const dictionary* shared_table = nullptr,
+    const code_lengths* previous_lengths = nullptr
+);
+
+// whether decode_block_range can decode part of a block of that type without the rest
+bool is_seekable(block_type type);
+// decodes bytes [begin, end) of a seekable block into the same positions of output, which has room for
+// the whole block. coded blocks start at the nearest seek point at or before begin, or at the start of the
+// stream when there is none, and stop at end; bytes outside the range may be overwritten.
+// takes what decode_block does, returns the same
+size_t decode_block_range(
+    block_type type,
+    const uint8_t* payload,
+    size_t payload_size,
+    char* output,
+    size_t raw_size,
+    size_t begin,
+    size_t end,
+    decode_table& table,
+    const dictionary* shared_table,
+    const code_lengths* previous_lengths,
+    uint32_t seek_interval,
+    const std::vector<uint64_t>& seek_points
+);
+
+// code lengths a block carries, returns false for blocks without them. repeat blocks refer to the
+// lengths of the nearest earlier block this returns true for
+bool read_code_lengths(block_type type, const uint8_t* payload, size_t payload_size, code_lengths& lengths);
+
+}  // namespace huffman
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace huffman {
+
+// crc-32 as in zip and gzip, continued from the crc of the data before when there is some
+uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0);
+
+}  // namespace huffman
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef DECODE_TABLE_H
+#define DECODE_TABLE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "archive_format.h"
+#include "bit_stream.h"
+
+namespace huffman {
+
+// one bitstream of an interleaved block and where its symbols go
+struct decode_stream {
+    const uint8_t* data;
+    size_t size;
+    char* output;
+    size_t count;
+};
+
+struct decode_entry {
+    uint32_t value;     // decoded symbol, or index of the first sub-table entry
+    uint8_t length;     // full code length, 0 marks a bit pattern no code starts with
+    uint8_t sub_bits;   // non-zero when the entry links to a sub-table indexed by the next sub_bits bits
+};
+
+// lookup-table decoder: the next kPrimaryBits bits of the stream index a primary table that resolves
+// every code up to that length at once, longer codes take one extra step through a sub-table
+class decode_table {
+public:
+    static constexpr int kPrimaryBits = 11;
+    static constexpr int kMaxCodeLength = 32;
+
+    // returns false when some code is longer than kMaxCodeLength
+    bool build(const std::map<char, std::string>& table);
+    bool build(const std::array<uint8_t, 256>& code_lengths);
+
+    // decodes exactly count symbols from the bitstream, throws on a corrupted stream
+    void decode(const uint8_t* data, size_t size, char* output, size_t count) const;
+    // same, starting bit_offset bits into the bitstream
+    void decode(const uint8_t* data, size_t size, uint64_t bit_offset, char* output, size_t count) const;
+    // decodes independent bitstreams in lockstep, so the lookups of different streams overlap
+    // instead of waiting on each other. at most kMaxStreams streams
+    void decode(const decode_stream* streams, int stream_count) const;
+    // decodes a bitstream in which every symbol is coded with the table the previous symbol selects,
+    // the first one with the table of symbol 0
+    static void decode(
+        const std::array<const decode_table*, 256>& tables,
+        const uint8_t* data,
+        size_t size,
+        char* output,
+        size_t count
+    );
+
+    // decodes the next symbol on its own, the reader has to hold at least get_max_code_length() bits
+    char decode_next(bit_reader& reader) const;
+
+    [[nodiscard]] int get_max_code_length() const;
+
+private:
+    struct code {
+        uint8_t symbol;
+        uint32_t bits;
+        int length;
+    };
+
+    // throws when the codes are not prefix-free
+    void build_entries(const std::vector<code>& codes);
+
+    // kept between builds, so rebuilding a table allocates nothing
+    std::vector<code> codes_;
+    std::vector<decode_entry> entries_;
+    int max_code_length_;
+};
+
+// one table lookup, and a second one through a sub-table for codes longer than kPrimaryBits.
+// throws on a bit pattern no code starts with
+inline char decode_symbol(const decode_entry* entries, bit_reader& reader) {
+    decode_entry entry = entries[reader.peek(decode_table::kPrimaryBits)];
+    if (entry.sub_bits != 0) {
+        entry = entries[entry.value + ((reader.get_buffer() << decode_table::kPrimaryBits) >> (64 - entry.sub_bits))];
+    }
+    if (entry.length == 0) {
+        throw std::runtime_error("Corrupted compressed data!");
+    }
+    reader.consume(entry.length);
+    return static_cast<char>(entry.value);
+}
+
+inline char decode_table::decode_next(bit_reader& reader) const {
+    return huffman::decode_symbol(entries_.data(), reader);
+}
+
+}  // namespace huffman
+
+#endif
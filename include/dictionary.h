@@ -0,0 +1,55 @@
+#ifndef DICTIONARY_H
+#define DICTIONARY_H
+
+#include <array>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "bit_stream.h"
+#include "decode_table.h"
+#include "histogram.h"
+
+namespace huffman {
+
+// dictionary file layout: magic, u32 dictionary id, packed code lengths of all 256 byte values
+constexpr std::array<char, 4> kDictionaryMagic = {'H', 'F', 'Z', 'D'};
+
+// bytes the samples never contain still need codes, a longer limit than the block default keeps them
+// from taking code space away from the common ones
+constexpr int kDefaultDictionaryCodeLength = 15;
+
+// code table trained once on sample data and shared by both sides, blocks encoded with it carry
+// the dictionary id instead of their own code lengths. every byte value has a code, so any input fits
+class dictionary {
+public:
+    // bytes the samples never contain still get codes, as long as max_code_length allows
+    static dictionary train(const histogram& samples, int max_code_length);
+    // counts every byte of the sample files, throws when one can't be read
+    static dictionary train(const std::vector<std::string>& sample_files, int max_code_length);
+    // throws on a malformed dictionary
+    static dictionary load(std::istream& input);
+    void save(std::ostream& output) const;
+
+    // hash of the code lengths, an archive names its dictionary by it
+    [[nodiscard]] uint32_t get_id() const;
+    [[nodiscard]] const std::array<uint8_t, 256>& get_code_lengths() const;
+    [[nodiscard]] const std::array<huffman_code, 256>& get_codes() const;
+    [[nodiscard]] int get_max_code_length() const;
+    // built once, shared by every block that uses the dictionary
+    [[nodiscard]] const decode_table& get_decode_table() const;
+
+private:
+    explicit dictionary(const std::array<uint8_t, 256>& code_lengths);
+
+    uint32_t id_;
+    std::array<uint8_t, 256> code_lengths_;
+    std::array<huffman_code, 256> codes_;
+    int max_code_length_;
+    decode_table table_;
+};
+
+}  // namespace huffman
+
+#endif
@@ -1,42 +1,179 @@
 #ifndef ENCODING_H
 #define ENCODING_H
 
+#include <cstdint>
 #include <fstream>
+#include <iostream>
+#include <memory>
 #include <string>
+#include <vector>
+#include "archive_format.h"
+#include "block_codec.h"
+#include "decode_table.h"
+#include "dictionary.h"
 #include "huffman_tree.h"
+#include "input_source.h"
+#include "thread_pool.h"
 
 namespace huffman {
 
+enum class archive_kind { original, blocks, message };
+
 class binary_io {
 public:
-    void write_frequency_table(std::ofstream& output, const huffman_tree& tree);
-    void write_bits(std::ofstream& output, std::string source_file, const huffman_tree& tree);
+    void write_frequency_table(std::ostream& output, const huffman_tree& tree);
+    void write_bits(std::ostream& output, std::string source_file, const huffman_tree& tree);
+    void write_bits(std::ostream& output, const uint8_t* data, size_t size, const huffman_tree& tree);
+
+    void write_archive_header(std::ostream& output, uint32_t block_size);
+    // a message takes a single block record and no index
+    void write_message_header(std::ostream& output);
+    void write_block(std::ostream& output, const encoded_block& block);
+    // seek points of the blocks written are added when seek_interval isn't zero
+    void write_block_index(std::ostream& output, uint32_t seek_interval = 0);
+
+    void read_frequency_table(std::istream& input, huffman_tree& tree);
+    void read_bits(std::istream& input, huffman_tree& tree, std::ostream& output);
 
-    void read_frequency_table(std::ifstream& input, huffman_tree& tree);
-    void read_bits(std::ifstream& input, huffman_tree& tree, const std::string& filename);
+    archive_kind read_magic(std::istream& input);
+    uint32_t read_archive_header(std::istream& input);
+    // returns false on the end record
+    bool read_block(std::istream& input, block_type& type, uint32_t& raw_size, std::vector<uint8_t>& payload);
+    // returns false when the archive has no trailer, the stream is left where it was
+    bool read_block_index(std::istream& input, block_index& index);
+    void add_decoded_block(size_t raw_size, size_t payload_size, size_t metadata_size);
 
-    void print_sizes(std::string mode) const;
+    void print_sizes(std::string mode, std::ostream& report = std::cout) const;
 
     [[nodiscard]] size_t get_not_compressed_file_size() const;
     [[nodiscard]] size_t get_compressed_file_size() const;
     [[nodiscard]] size_t get_frequency_table_size() const;
 
 private:
-    int cur_position_in_byte;
+    std::vector<uint8_t> read_remaining(std::istream& input);
+    void write_decoded(const std::vector<uint8_t>& data, const decode_table& table, std::ostream& output);
+    void read_bits_tree_walk(const std::vector<uint8_t>& data, huffman_tree& tree, std::ostream& output);
+
+    uint64_t archive_offset_;
+    uint32_t table_block_;  // the last huffman or interleaved block written
+    std::vector<block_index_entry> block_index_;
+    std::vector<std::vector<uint64_t>> seek_points_;
 
     size_t not_compressed_file_size_;
     size_t compressed_file_size_;
     size_t frequency_table_size_;
 };
 
+struct compression_options {
+    size_t block_size = kDefaultBlockSize;
+    int max_code_length = kDefaultMaxCodeLength;
+    int streams = 1;                           // independent bitstreams per block, more of them decode faster
+    int context_order = 0;                     // 1 lets blocks pick each byte's table by the byte before it
+    int lz_level = 0;                          // match finder effort up to kMaxLzLevel, 0 turns it off
+    uint32_t seek_interval = 0;                // output bytes between seek points inside blocks, 0 for none
+    bool direct_output = false;                // output files bypass the page cache where the system allows
+    const dictionary* shared_table = nullptr;  // blocks it suits better than their own table use it
+    unsigned threads = 0;                      // zero means one per hardware thread
+    std::ostream* size_report = &std::cout;    // where the sizes summary goes, nullptr to skip it
+};
+
+// largest archive compressing size bytes with options can produce
+size_t compress_bound(size_t size, const compression_options& options = compression_options());
+
+// a compressor is meant to be long-lived: its thread pool and block buffers are kept between calls,
+// so compressing many small inputs costs no thread start-up and few allocations. not for concurrent use
 class huffman_compressor {
 public:
-    void compress_file(const std::string filename, const std::string output_file) const;
+    explicit huffman_compressor(compression_options options = compression_options());
+
+    // splits the file into blocks and encodes them in parallel, blocks are written in input order
+    void compress_file(const std::string filename, const std::string output_file);
+    // single pass over a stream that needn't be seekable, memory is bounded by the blocks in flight
+    void compress_stream(std::istream& input, std::ostream& output);
+    // archive into caller memory, capacity of compress_bound(size) always suffices.
+    // returns the archive size, throws when it doesn't fit
+    size_t compress(const uint8_t* data, size_t size, uint8_t* output, size_t capacity);
+    // appends the archive to output
+    void compress(const uint8_t* data, size_t size, std::vector<uint8_t>& output);
+    // writes the archive to output, which needn't be seekable
+    void compress(const uint8_t* data, size_t size, std::ostream& output);
+
+    // started on the first input of more than one block. callers may schedule their own work on it,
+    // blocks are queued behind whatever they submitted before
+    thread_pool& get_pool();
+
+private:
+    void compress_blocks(input_source& input, std::ostream& output);
+
+    compression_options options_;
+    std::unique_ptr<thread_pool> pool_;
+    encoded_block block_;
+};
+
+struct decompression_options {
+    const dictionary* shared_table = nullptr;  // the dictionary the archive was compressed with, if any
+    unsigned threads = 0;                      // zero means one per hardware thread
+    bool direct_output = false;                // output files bypass the page cache where the system allows
+    std::ostream* size_report = &std::cout;    // where the sizes summary goes, nullptr to skip it
 };
 
+// long-lived like huffman_compressor: the thread pool, decoding table and window buffers are kept between calls
 class huffman_decompressor {
 public:
-    void decompress_file(const std::string filename, const std::string output_file) const;
+    explicit huffman_decompressor(decompression_options options = decompression_options());
+
+    // with a block index the blocks are decoded in parallel, otherwise one after another
+    void decompress_file(const std::string filename, const std::string output_file);
+    // decodes blocks in archive order without seeking, the original format can't be read this way
+    void decompress_stream(std::istream& input, std::ostream& output);
+    // archive in memory into caller memory, returns the decompressed size, throws when it doesn't fit
+    size_t decompress(const uint8_t* data, size_t size, uint8_t* output, size_t capacity);
+    // appends the decompressed data to output
+    void decompress(const uint8_t* data, size_t size, std::vector<uint8_t>& output);
+    void decompress(const uint8_t* data, size_t size, std::ostream& output);
+    // writes length bytes of the original file from offset, clipped to its end, decoding only the blocks
+    // they fall in. needs a block archive with an index, throws when offset is past the end of the file
+    void decompress_range(const std::string& input_file, uint64_t offset, uint64_t length, std::ostream& output);
+    void decompress_range(
+        const uint8_t* data,
+        size_t size,
+        uint64_t offset,
+        uint64_t length,
+        std::vector<uint8_t>& output
+    );
+
+private:
+    // any format, the input has to be seekable
+    void decompress_archive(std::istream& input, std::ostream& output);
+    void decompress_blocks(std::istream& input, binary_io& bin_in, std::ostream& output);
+    // decodes the block of a message and writes length bytes of it from offset, clipped to its end
+    void decompress_message(
+        std::istream& input,
+        binary_io& bin_in,
+        uint64_t offset,
+        uint64_t length,
+        std::ostream& output
+    );
+    void decompress_range(std::istream& input, uint64_t offset, uint64_t length, std::ostream& output);
+    // decodes the blocks overlapping [begin, end) of the original file and writes that part of them
+    void decompress_indexed(
+        std::istream& input,
+        binary_io& bin_in,
+        const block_index& index,
+        uint64_t begin,
+        uint64_t end,
+        std::ostream& output
+    );
+    // code lengths a repeat block starting the decoding at the given block refers to, false for none
+    bool find_previous_table(std::istream& input, const block_index& index, size_t block, code_lengths& lengths);
+    // started on the first archive of more than one block
+    thread_pool& get_pool();
+
+    decompression_options options_;
+    std::unique_ptr<thread_pool> pool_;
+    decode_table table_;
+    std::vector<uint8_t> compressed_;
+    std::vector<char> decoded_;
 };
 
 }  // namespace huffman
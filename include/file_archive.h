@@ -0,0 +1,125 @@
+#ifndef FILE_ARCHIVE_H
+#define FILE_ARCHIVE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "encoding.h"
+#include "file_output.h"
+#include "input_source.h"
+
+namespace huffman {
+
+// multi-file archive layout:
+//   magic
+//   members: u16 name size, name, u64 original size, u32 crc-32 of the original data, then the member
+//   compressed as a block archive of its own
+//   central directory: u32 member count, per member u16 name size, name, u64 offset of its header,
+//   u64 size of its block archive, u64 original size, u32 crc-32
+//   trailer: u64 offset of the central directory, directory magic
+constexpr std::array<char, 4> kFileArchiveMagic = {'H', 'F', 'Z', 'M'};
+constexpr std::array<char, 4> kDirectoryMagic = {'H', 'F', 'Z', 'C'};
+
+struct archive_member {
+    std::string name;
+    uint64_t offset;           // offset of the member header from the start of the archive
+    uint64_t compressed_size;  // size of the member's block archive
+    uint64_t original_size;
+    uint32_t checksum;
+};
+
+// member read and checked, and compressed already when it fits a single block
+struct loaded_member {
+    std::unique_ptr<mapped_file> file;
+    std::vector<uint8_t> data;  // the whole file when it can't be mapped
+    std::vector<uint8_t> archive;
+    uint64_t size;
+    uint32_t checksum;
+    bool compressed;
+};
+
+// files are read, checked and compressed on the compressor's thread pool while earlier members are written.
+// consecutive small files go to the pool in batches, a batch task runs its first file and leaves the others
+// on its worker's deque for idle workers to steal; a file of several blocks is split into blocks instead.
+// members are written in the order they were added, with a bounded number of batches held in memory
+class archive_writer {
+public:
+    archive_writer(const std::string& filename, compression_options options = compression_options());
+    // waits for the members still being compressed, an archive that isn't finished has no directory
+    ~archive_writer();
+
+    archive_writer(const archive_writer&) = delete;
+    archive_writer& operator=(const archive_writer&) = delete;
+
+    // the name is stored as given, extraction recreates it as a relative path.
+    // the member may be written later, errors reading the file come from a later call or finish()
+    void add_file(const std::string& filename, const std::string& name);
+    // written before it returns
+    void add(const std::string& name, const uint8_t* data, size_t size);
+    // writes the central directory, no member can be added afterwards
+    void finish();
+
+    // members written so far
+    [[nodiscard]] const std::vector<archive_member>& get_members() const;
+
+private:
+    struct pending_batch {
+        std::vector<std::string> names;
+        std::future<std::vector<std::future<loaded_member>>> members;
+    };
+
+    void submit_batch();
+    // keeps at most max_pending batches in flight, writing the oldest ones
+    void drain(size_t max_pending);
+    loaded_member load(const std::string& filename);
+    // compresses data unless archive holds it compressed already
+    void write_member(
+        const std::string& name,
+        const uint8_t* data,
+        uint64_t size,
+        uint32_t checksum,
+        const std::vector<uint8_t>* archive
+    );
+
+    compression_options options_;
+    file_output_buffer output_buffer_;
+    std::ostream output_;
+    std::vector<std::unique_ptr<huffman_compressor>> worker_compressors_;  // one per pool worker
+    std::vector<std::pair<std::string, std::string>> batch_;              // file and member name
+    size_t batch_size_;
+    std::deque<pending_batch> pending_;
+    std::vector<archive_member> members_;
+    bool finished_;
+    huffman_compressor compressor_;
+};
+
+// maps the archive and reads its central directory, a member is then decoded without touching the others
+class archive_reader {
+public:
+    // throws when the file isn't a multi-file archive or its directory is corrupted
+    archive_reader(const std::string& filename, decompression_options options = decompression_options());
+
+    [[nodiscard]] const std::vector<archive_member>& get_members() const;
+    // nullptr when there's no member of that name
+    [[nodiscard]] const archive_member* find(const std::string& name) const;
+
+    // throws when the member is corrupted or its data doesn't match its checksum
+    void extract(const archive_member& member, std::ostream& output);
+
+private:
+    mapped_file archive_;
+    huffman_decompressor decompressor_;
+    std::vector<archive_member> members_;
+};
+
+}  // namespace huffman
+
+#endif
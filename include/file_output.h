@@ -0,0 +1,65 @@
+#ifndef FILE_OUTPUT_H
+#define FILE_OUTPUT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <streambuf>
+#include <string>
+
+namespace huffman {
+
+// write-only stream buffer straight over a file: bytes gather in an owned, page-aligned buffer that goes out
+// with one pwrite whenever it fills, and a write larger than the buffer skips it. with direct output the
+// file is opened with O_DIRECT where the file system allows it, so the data bypasses the page cache; only
+// whole pages are written then, and the tail once the file is closed
+class file_output_buffer : public std::streambuf {
+public:
+    static constexpr size_t kAlignment = 4096;
+    static constexpr size_t kDefaultCapacity = size_t(1) << 20;
+
+    // creates or truncates the file, throws when it can't. the capacity is rounded up to whole pages
+    explicit file_output_buffer(
+        const std::string& filename,
+        bool direct = false,
+        size_t capacity = kDefaultCapacity
+    );
+    // closes the file, errors are only reported by close()
+    ~file_output_buffer() override;
+
+    file_output_buffer(const file_output_buffer&) = delete;
+    file_output_buffer& operator=(const file_output_buffer&) = delete;
+
+    // writes out what's pending and closes the file, throws when any write failed
+    void close();
+
+    [[nodiscard]] bool is_direct() const;
+
+protected:
+    int_type overflow(int_type symbol) override;
+    std::streamsize xsputn(const char* data, std::streamsize size) override;
+    int sync() override;
+    // only tells the current position, so tellp works
+    pos_type seekoff(off_type offset, std::ios_base::seekdir direction, std::ios_base::openmode which) override;
+
+private:
+    // writes the buffered bytes, all of them or, for direct output, the whole pages among them
+    bool flush_buffer(bool whole_pages);
+    bool write_at(const char* data, size_t size);
+
+    struct free_deleter {
+        void operator()(char* data) const { std::free(data); }
+    };
+
+    int descriptor_;
+    bool direct_;
+    bool failed_;
+    std::unique_ptr<char, free_deleter> buffer_;
+    size_t capacity_;
+    uint64_t file_offset_;  // bytes written to the file so far
+};
+
+}  // namespace huffman
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace huffman {
+
+// byte frequencies counted straight into flat arrays
+class histogram {
+public:
+    histogram();
+
+    // adds the bytes of data to the counts, can be called repeatedly
+    void add(const uint8_t* data, size_t size);
+    void clear();
+
+    [[nodiscard]] const std::array<uint64_t, 256>& get_counts() const;
+    [[nodiscard]] uint64_t get_total() const;
+    [[nodiscard]] int get_alphabet_power() const;
+    // order-0 entropy of the counted bytes in bits, no prefix code packs them into fewer
+    [[nodiscard]] double get_entropy_bits() const;
+
+private:
+    std::array<uint64_t, 256> counts_;
+    uint64_t total_;
+};
+
+}  // namespace huffman
+
+#endif
@@ -1,57 +1,97 @@
 #ifndef HUFFMAN_TREE_H
 #define HUFFMAN_TREE_H
 
-#include <list>
+#include <array>
+#include <cstddef>
+#include <cstdint>
 #include <map>
 #include <string>
+#include "bit_stream.h"
+#include "histogram.h"
 
 namespace huffman {
 
+// children are linked by 16-bit offsets relative to the node itself, so a node is only valid where it was
+// constructed and can't be copied. nodes normally live in a huffman_tree pool
 class huffman_tree_node {
 public:
-    huffman_tree_node(char symbol, int frequency);
+    huffman_tree_node();
+    huffman_tree_node(char symbol, uint64_t frequency);
     huffman_tree_node(huffman_tree_node* left_child, huffman_tree_node* right_child);
+    huffman_tree_node(const huffman_tree_node&) = delete;
+    huffman_tree_node& operator=(const huffman_tree_node&) = delete;
 
-    [[nodiscard]] int get_frequency() const;
+    [[nodiscard]] uint64_t get_frequency() const;
     [[nodiscard]] char get_symbol() const;
     [[nodiscard]] huffman_tree_node* get_left_child() const;
     [[nodiscard]] huffman_tree_node* get_right_child() const;
 
 private:
+    uint64_t frequency_;
+    int16_t left_offset_;    // 0 when there is no child
+    int16_t right_offset_;
     char symbol_;
-    int frequency_;
-    huffman_tree_node* left_child_;
-    huffman_tree_node* right_child_;
 };
 
+// the tree is built in a fixed pool of nodes inside the object: building allocates nothing and
+// destroying it is a reset of the pool
 class huffman_tree {
 public:
+    // a full binary tree with 256 leaves
+    static constexpr size_t kMaxNodes = 2 * 256 - 1;
+
+    huffman_tree();
+
     void build();
     void build_table();
     void build_code(huffman_tree_node* node, std::string code);
     void build_frequency_table(const std::string& filename);
+    void build_frequency_table(const uint8_t* data, size_t size);
+    void build_frequency_table(const histogram& counts);
 
     [[nodiscard]] huffman_tree_node* get_root() const;
     [[nodiscard]] int get_alphabet_power() const;
     [[nodiscard]] std::map<char, int> get_chars_frequency() const;
     [[nodiscard]] std::map<char, std::string> get_table() const;
+    // the code table as bit patterns, throws when a code is longer than 32 bits
+    [[nodiscard]] std::array<huffman_code, 256> get_codes() const;
+    // depth of every leaf of the built tree, 0 for symbols without a code and 1 for a lone root.
+    // build_canonical_codes turns them into canonical codes
+    [[nodiscard]] std::array<uint8_t, 256> get_code_lengths() const;
     [[nodiscard]] int get_number_of_chars() const;
 
     void set_alphabet_power(const int value);
     void add_symbol(const char symbol, const int frequency);
 
+    // releases every node of the tree, start_node is kept for the original interface and may be any node
     void destroy(const huffman_tree_node* start_node);
 
 private:
+    template <typename... Args>
+    huffman_tree_node* make_node(Args... args);
+
+    std::array<huffman_tree_node, kMaxNodes> nodes_;
+    size_t node_count_;
     huffman_tree_node* root_;
 
-    std::map<char, int> chars_frequency_;
+    std::array<uint64_t, 256> chars_frequency_;
     std::map<char, std::string> table_;
-    std::list<huffman_tree_node*> list_of_nodes_;
     int alphabet_power_;
     int number_of_chars_;
 };
 
+// code lengths of an optimal prefix code for counts, computed on a flat node array with two queues
+// and no tree. symbols with zero count get no code, a lone symbol gets a one bit code
+void build_code_lengths(const uint64_t* counts, size_t alphabet_size, uint8_t* lengths);
+
+// same, with no code longer than max_length: the optimal limited code comes from package-merge
+// whenever the unlimited one is too deep. throws when 2^max_length can't cover the alphabet
+void build_code_lengths(const uint64_t* counts, size_t alphabet_size, uint8_t* lengths, int max_length);
+
+// assigns canonical codes: shorter codes get smaller values, equal lengths follow symbol order.
+// throws when a length exceeds 32 bits
+std::array<huffman_code, 256> build_canonical_codes(const std::array<uint8_t, 256>& lengths);
+
 struct node_comparing {
     bool operator()(const huffman_tree_node* node1, const huffman_tree_node* node2) const {
         return node1->get_frequency() < node2->get_frequency();
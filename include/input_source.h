@@ -0,0 +1,68 @@
+#ifndef INPUT_SOURCE_H
+#define INPUT_SOURCE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace huffman {
+
+// read-only mapping of a whole file, advised for sequential access
+class mapped_file {
+public:
+    // throws when the file can't be opened, files that can't be mapped (pipes, devices) are left unmapped
+    explicit mapped_file(const std::string& filename);
+    ~mapped_file();
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    [[nodiscard]] bool is_mapped() const;
+    [[nodiscard]] const uint8_t* get_data() const;
+    [[nodiscard]] size_t get_size() const;
+
+private:
+    const uint8_t* data_;
+    size_t size_;
+    bool mapped_;
+};
+
+// the whole file read through a stream, for files that can't be mapped
+std::vector<uint8_t> read_file(const std::string& filename);
+
+// piece of input handed to an encoder: points into the mapping or the caller's memory,
+// or owns a copy when the input comes from a stream
+struct input_block {
+    const uint8_t* data;
+    size_t size;
+    std::vector<uint8_t> storage;
+};
+
+// splits input into blocks, straight from the file mapping when possible and through a stream otherwise
+class input_source {
+public:
+    explicit input_source(const std::string& filename);
+    // blocks are read one at a time, so the stream needn't be seekable
+    explicit input_source(std::istream& stream);
+    // blocks point straight into data, which must outlive them
+    input_source(const uint8_t* data, size_t size);
+
+    // returns an empty block once the input is exhausted
+    input_block next_block(size_t max_size);
+
+private:
+    std::unique_ptr<mapped_file> mapping_;
+    const uint8_t* data_;
+    size_t size_;
+    size_t position_;
+    std::ifstream file_stream_;
+    std::istream* stream_;
+};
+
+}  // namespace huffman
+
+#endif
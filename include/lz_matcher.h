@@ -0,0 +1,32 @@
+#ifndef LZ_MATCHER_H
+#define LZ_MATCHER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace huffman {
+
+// shortest match worth a sequence, and the longest a sequence holds
+constexpr uint32_t kLzMinMatch = 4;
+constexpr uint32_t kLzMaxLength = 65535;
+// matches reach at most this far back, and never before the start of the block
+constexpr uint32_t kLzWindow = uint32_t(1) << 20;
+
+constexpr int kMaxLzLevel = 9;
+
+// literal_length bytes copied as they are, then match_length bytes copied from distance bytes back.
+// a zero match length means literals only
+struct lz_sequence {
+    uint32_t literal_length;
+    uint32_t match_length;
+    uint32_t distance;
+};
+
+// greedy parse of data into sequences with hash chains of 4-byte prefixes, the level (1 to kMaxLzLevel)
+// sets how many earlier positions are tried for every match. the sequences cover all of data
+void find_matches(const uint8_t* data, size_t size, int level, std::vector<lz_sequence>& sequences);
+
+}  // namespace huffman
+
+#endif
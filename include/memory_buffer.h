@@ -0,0 +1,42 @@
+#ifndef MEMORY_BUFFER_H
+#define MEMORY_BUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <streambuf>
+#include <vector>
+
+namespace huffman {
+
+// seekable read-only stream buffer over caller memory, nothing is copied
+class input_memory_buffer : public std::streambuf {
+public:
+    input_memory_buffer(const uint8_t* data, size_t size);
+
+protected:
+    pos_type seekoff(off_type offset, std::ios_base::seekdir direction, std::ios_base::openmode which) override;
+    pos_type seekpos(pos_type position, std::ios_base::openmode which) override;
+};
+
+// write-only stream buffer into caller memory: a fixed span that fails the stream once it's full,
+// or a vector that grows and is appended to
+class output_memory_buffer : public std::streambuf {
+public:
+    output_memory_buffer(uint8_t* data, size_t capacity);
+    explicit output_memory_buffer(std::vector<uint8_t>& output);
+
+    // bytes written so far
+    [[nodiscard]] size_t get_size() const;
+
+protected:
+    int_type overflow(int_type symbol) override;
+    std::streamsize xsputn(const char* data, std::streamsize size) override;
+
+private:
+    std::vector<uint8_t>* output_;
+    size_t output_start_;
+};
+
+}  // namespace huffman
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace huffman {
+
+// fixed set of worker threads, results and exceptions come back through futures.
+// tasks submitted from outside the pool go to a shared queue and are started in submission order.
+// tasks submitted by a running task go to its worker's own deque: the worker takes the newest of them,
+// idle workers steal the oldest, so nested work stays local unless somebody has nothing else to do
+class thread_pool {
+public:
+    // zero threads means one per hardware thread
+    explicit thread_pool(unsigned threads);
+    ~thread_pool();
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    template <typename Task>
+    std::future<std::invoke_result_t<Task>> submit(Task task) {
+        auto packaged = std::make_shared<std::packaged_task<std::invoke_result_t<Task>()>>(std::move(task));
+        std::future<std::invoke_result_t<Task>> result = packaged->get_future();
+        push([packaged]() { (*packaged)(); });
+        return result;
+    }
+
+    [[nodiscard]] unsigned get_thread_count() const;
+    // index of the calling thread among this pool's workers, -1 on any other thread
+    [[nodiscard]] int get_worker_index() const;
+
+private:
+    struct worker_queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void push(std::function<void()> task);
+    bool take(size_t worker, std::function<void()>& task);
+    void run(size_t worker);
+
+    std::vector<std::thread> workers_;
+    std::vector<std::unique_ptr<worker_queue>> local_;
+    std::queue<std::function<void()>> shared_;
+    std::mutex mutex_;  // guards shared_, pending_ and stopping_
+    std::condition_variable task_available_;
+    size_t pending_;  // tasks in any queue
+    bool stopping_;
+};
+
+}  // namespace huffman
+
+#endif
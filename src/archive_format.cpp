@@ -0,0 +1,171 @@
+#include "archive_format.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace huffman {
+
+namespace {
+
+// alphabets of at least this size store their symbols as a bitmap
+constexpr int kSymbolBitmapThreshold = 32;
+constexpr int kSymbolBitmapSize = 256 / 8;
+
+size_t symbols_size(int alphabet_power) {
+    return alphabet_power < kSymbolBitmapThreshold ? alphabet_power : kSymbolBitmapSize;
+}
+
+size_t lengths_size(int alphabet_power, int length_bits) { return (alphabet_power * length_bits + 7) / 8; }
+
+// symbols with a code and the bits needed for the longest length
+void measure_code_lengths(const std::array<uint8_t, 256>& lengths, int& alphabet_power, int& length_bits) {
+    alphabet_power = 0;
+    int max_length = 0;
+    for (uint8_t length : lengths) {
+        alphabet_power += length != 0;
+        max_length = std::max<int>(max_length, length);
+    }
+
+    length_bits = 1;
+    while ((1 << length_bits) <= max_length) {
+        length_bits += 1;
+    }
+}
+
+}  // namespace
+
+void pack_code_lengths(const std::array<uint8_t, 256>& lengths, std::vector<uint8_t>& output) {
+    int alphabet_power, length_bits;
+    measure_code_lengths(lengths, alphabet_power, length_bits);
+
+    output.push_back(static_cast<uint8_t>(alphabet_power - 1));
+    output.push_back(static_cast<uint8_t>(length_bits));
+
+    if (alphabet_power < kSymbolBitmapThreshold) {
+        for (int symbol = 0; symbol < 256; ++symbol) {
+            if (lengths[symbol] != 0) {
+                output.push_back(static_cast<uint8_t>(symbol));
+            }
+        }
+    } else {
+        size_t bitmap = output.size();
+        output.resize(bitmap + kSymbolBitmapSize, 0);
+        for (int symbol = 0; symbol < 256; ++symbol) {
+            if (lengths[symbol] != 0) {
+                output[bitmap + symbol / 8] |= 1 << (symbol % 8);
+            }
+        }
+    }
+
+    size_t packed = output.size();
+    output.resize(packed + lengths_size(alphabet_power, length_bits), 0);
+    size_t bit_position = 0;
+    for (uint8_t length : lengths) {
+        if (length == 0) {
+            continue;
+        }
+        for (int i = length_bits - 1; i >= 0; --i, ++bit_position) {
+            output[packed + bit_position / 8] |= ((length >> i) & 1) << (7 - bit_position % 8);
+        }
+    }
+}
+
+size_t packed_code_lengths_size(const uint8_t* prefix) {
+    int alphabet_power = prefix[0] + 1;
+    return 2 + symbols_size(alphabet_power) + lengths_size(alphabet_power, prefix[1]);
+}
+
+size_t packed_code_lengths_size(const std::array<uint8_t, 256>& lengths) {
+    int alphabet_power, length_bits;
+    measure_code_lengths(lengths, alphabet_power, length_bits);
+    return 2 + symbols_size(alphabet_power) + lengths_size(alphabet_power, length_bits);
+}
+
+size_t min_packed_code_lengths_size(int alphabet_power) {
+    // the longest of that many prefix codes has at least ceil(log2(alphabet_power)) bits
+    int max_length = 1;
+    while ((1 << max_length) < alphabet_power) {
+        max_length += 1;
+    }
+
+    int length_bits = 1;
+    while ((1 << length_bits) <= max_length) {
+        length_bits += 1;
+    }
+    return 2 + symbols_size(alphabet_power) + lengths_size(alphabet_power, length_bits);
+}
+
+size_t unpack_code_lengths(const uint8_t* data, size_t size, std::array<uint8_t, 256>& lengths) {
+    if (size < 2 || data[1] == 0 || data[1] > 8 || size < packed_code_lengths_size(data)) {
+        throw std::runtime_error("Corrupted code lengths header!");
+    }
+
+    int alphabet_power = data[0] + 1;
+    int length_bits = data[1];
+    const uint8_t* symbols = data + 2;
+    const uint8_t* packed = symbols + symbols_size(alphabet_power);
+
+    std::array<uint8_t, 256> present{};
+    if (alphabet_power < kSymbolBitmapThreshold) {
+        for (int i = 0; i < alphabet_power; ++i) {
+            present[symbols[i]] = 1;
+        }
+    } else {
+        for (int symbol = 0; symbol < 256; ++symbol) {
+            present[symbol] = (symbols[symbol / 8] >> (symbol % 8)) & 1;
+        }
+    }
+
+    lengths.fill(0);
+    size_t bit_position = 0;
+    int unpacked = 0;
+    for (int symbol = 0; symbol < 256; ++symbol) {
+        if (!present[symbol]) {
+            continue;
+        }
+        if (unpacked++ == alphabet_power) {
+            throw std::runtime_error("Corrupted code lengths header!");
+        }
+
+        int length = 0;
+        for (int i = 0; i < length_bits; ++i, ++bit_position) {
+            length = (length << 1) | ((packed[bit_position / 8] >> (7 - bit_position % 8)) & 1);
+        }
+        if (length == 0) {
+            throw std::runtime_error("Corrupted code lengths header!");
+        }
+        lengths[symbol] = static_cast<uint8_t>(length);
+    }
+
+    if (unpacked != alphabet_power) {
+        throw std::runtime_error("Corrupted code lengths header!");
+    }
+    return packed_code_lengths_size(data);
+}
+
+uint64_t block_index::get_compressed_end(size_t block) const {
+    return block + 1 < entries.size() ? entries[block + 1].compressed_offset : blocks_end;
+}
+
+uint64_t block_index::get_raw_size(size_t block) const {
+    uint64_t end = block + 1 < entries.size() ? entries[block + 1].uncompressed_offset : raw_size;
+    return end - entries[block].uncompressed_offset;
+}
+
+block_header parse_block_header(const uint8_t* data, size_t size) {
+    block_header header;
+    if (size < kBlockHeaderSize) {
+        throw std::runtime_error("Archive is truncated!");
+    }
+
+    header.type = static_cast<block_type>(data[0]);
+    std::memcpy(&header.raw_size, data + 1, sizeof(header.raw_size));
+    std::memcpy(&header.payload_size, data + 1 + sizeof(header.raw_size), sizeof(header.payload_size));
+    if (size - kBlockHeaderSize < header.payload_size) {
+        throw std::runtime_error("Archive is truncated!");
+    }
+    return header;
+}
+
+}  // namespace huffman
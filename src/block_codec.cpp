@@ -0,0 +1,1088 @@
+#include "block_codec.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include "decode_table.h"
+#include "huffman_tree.h"
+
+namespace huffman {
+
+uint64_t count_encoded_bits(const histogram& counts, const std::array<huffman_code, 256>& codes) {
+    uint64_t bits = 0;
+    for (int symbol = 0; symbol < 256; ++symbol) {
+        bits += counts.get_counts()[symbol] * codes[symbol].length;
+    }
+    return bits;
+}
+
+size_t encode_bits(
+    const uint8_t* data,
+    size_t size,
+    const std::array<huffman_code, 256>& codes,
+    int max_length,
+    uint8_t* output
+) {
+    bit_writer writer(output);
+    const uint8_t* end = data + size;
+
+    // after a flush at most 7 bits are pending, the rest of the register takes this many codes
+    const int codes_per_flush = 57 / std::max(max_length, 1);
+    while (end - data >= codes_per_flush) {
+        for (int i = 0; i < codes_per_flush; ++i) {
+            writer.put(codes[*data++]);
+        }
+        writer.flush();
+    }
+    while (data != end) {
+        writer.put(codes[*data++]);
+        writer.flush();
+    }
+
+    return writer.finish();
+}
+
+namespace {
+
+// symbols of every segment but the last, which takes the rest
+size_t segment_size(size_t size, int streams) { return (size + streams - 1) / streams; }
+
+// stream count and stream sizes ahead of interleaved streams
+size_t stream_table_size(int streams) { return 1 + (streams - 1) * sizeof(uint32_t); }
+
+// payload of a block coded with the previous block's table, every stream may end with a partial byte
+size_t repeat_size(uint64_t bits, int streams) { return stream_table_size(streams) + (bits + 7) / 8 + streams - 1; }
+
+// bits of counts under lengths, or none when some counted symbol has no code
+bool count_bits(const histogram& counts, const code_lengths& lengths, uint64_t& bits) {
+    bits = 0;
+    for (int symbol = 0; symbol < 256; ++symbol) {
+        uint64_t count = counts.get_counts()[symbol];
+        if (count != 0 && lengths[symbol] == 0) {
+            return false;
+        }
+        bits += count * lengths[symbol];
+    }
+    return true;
+}
+
+// appends the stream table and the streams, every stream may end with a partial byte
+// and the last one needs the writer's slack
+void append_streams(
+    const uint8_t* data,
+    size_t size,
+    const std::array<huffman_code, 256>& codes,
+    int max_length,
+    uint64_t bit_length,
+    int streams,
+    std::vector<uint8_t>& payload
+) {
+    // stream sizes are only known once encoded, so their slots are filled in afterwards
+    payload.push_back(static_cast<uint8_t>(streams));
+    size_t sizes_offset = payload.size();
+    size_t written = sizes_offset + (streams - 1) * sizeof(uint32_t);
+    payload.resize(written + (bit_length + 7) / 8 + streams + 8);
+
+    size_t segment = segment_size(size, streams);
+    for (int stream = 0; stream < streams; ++stream) {
+        size_t begin = std::min(size, stream * segment);
+        size_t end = std::min(size, begin + segment);
+        uint8_t* output = payload.data() + written;
+        uint32_t stream_size = encode_bits(data + begin, end - begin, codes, max_length, output);
+        if (stream + 1 < streams) {
+            uint8_t* slot = payload.data() + sizes_offset + stream * sizeof(uint32_t);
+            std::memcpy(slot, &stream_size, sizeof(stream_size));
+        }
+        written += stream_size;
+    }
+    payload.resize(written);
+}
+
+// reads a stream table and points every stream at its data and its segment of output, returns the count
+int parse_streams(
+    const uint8_t* payload,
+    size_t payload_size,
+    char* output,
+    size_t raw_size,
+    std::array<decode_stream, kMaxStreams>& spans
+) {
+    int streams = payload_size != 0 ? payload[0] : 0;
+    if (streams < 1 || streams > kMaxStreams || payload_size < stream_table_size(streams)) {
+        throw std::runtime_error("Corrupted stream table!");
+    }
+
+    size_t offset = stream_table_size(streams);
+    size_t segment = segment_size(raw_size, streams);
+    for (int stream = 0; stream < streams; ++stream) {
+        uint32_t stream_size = payload_size - offset;
+        if (stream + 1 < streams) {
+            std::memcpy(&stream_size, payload + 1 + stream * sizeof(uint32_t), sizeof(uint32_t));
+            if (stream_size > payload_size - offset) {
+                throw std::runtime_error("Corrupted stream table!");
+            }
+        }
+        size_t begin = std::min(raw_size, stream * segment);
+        spans[stream] = {payload + offset, stream_size, output + begin, std::min(raw_size, begin + segment) - begin};
+        offset += stream_size;
+    }
+    return streams;
+}
+
+// decodes a stream table and its streams, returns the size of the stream table
+size_t decode_streams(
+    const decode_table& table,
+    const uint8_t* payload,
+    size_t payload_size,
+    char* output,
+    size_t raw_size
+) {
+    std::array<decode_stream, kMaxStreams> spans;
+    int streams = parse_streams(payload, payload_size, output, raw_size, spans);
+    table.decode(spans.data(), streams);
+    return stream_table_size(streams);
+}
+
+// bit offset of every multiple of interval inside the block from the start of its segment's stream,
+// summed from the code lengths rather than taken from the encoder
+void add_seek_points(
+    const uint8_t* data,
+    size_t size,
+    const std::array<huffman_code, 256>& codes,
+    int streams,
+    uint32_t interval,
+    std::vector<uint64_t>& points
+) {
+    size_t segment = segment_size(size, streams);
+    for (size_t begin = 0; begin < size; begin += segment) {
+        size_t end = std::min(size, begin + segment);
+        size_t position = begin;
+        uint64_t bits = 0;
+        for (size_t point = std::max<size_t>(interval, (begin + interval - 1) / interval * interval); point < end;
+             point += interval) {
+            for (; position < point; ++position) {
+                bits += codes[data[position]].length;
+            }
+            points.push_back(bits);
+        }
+    }
+}
+
+// index bits per byte of a packed block
+int packed_width(int alphabet_power) { return alphabet_power <= 2 ? 1 : 2; }
+
+size_t packed_size(int alphabet_power, size_t size) {
+    return 1 + alphabet_power + (size * packed_width(alphabet_power) + 7) / 8;
+}
+
+void store_raw(block_plan& plan, size_t size) {
+    plan.type = block_type::stored;
+    plan.lengths.fill(0);
+    plan.bit_length = uint64_t(size) * 8;
+    plan.size = size;
+}
+
+void append_packed(const uint8_t* data, size_t size, const histogram& counts, std::vector<uint8_t>& payload) {
+    std::array<uint8_t, 256> indices{};
+    size_t symbols = payload.size();
+    payload.push_back(0);
+    for (int symbol = 0; symbol < 256; ++symbol) {
+        if (counts.get_counts()[symbol] != 0) {
+            indices[symbol] = payload[symbols]++;
+            payload.push_back(static_cast<uint8_t>(symbol));
+        }
+    }
+
+    const int width = packed_width(payload[symbols]);
+    const size_t per_byte = 8 / width;
+    size_t written = payload.size();
+    payload.resize(written + (size * width + 7) / 8);
+    uint8_t* output = payload.data() + written;
+    for (size_t begin = 0; begin < size; begin += per_byte) {
+        size_t end = std::min(size, begin + per_byte);
+        uint8_t byte = 0;
+        for (size_t i = begin; i < end; ++i) {
+            byte = (byte << width) | indices[data[i]];
+        }
+        *output++ = byte << (width * (per_byte - (end - begin)));
+    }
+}
+
+// every packed byte expands to all its symbols at once through a table built for the block
+template <int width>
+void expand_packed(const uint8_t* symbols, int alphabet_power, const uint8_t* packed, char* output, size_t size) {
+    constexpr int per_byte = 8 / width;
+    std::array<std::array<char, per_byte>, 256> expansions;
+    std::array<bool, 256> valid;
+    for (int byte = 0; byte < 256; ++byte) {
+        valid[byte] = true;
+        for (int i = 0; i < per_byte; ++i) {
+            int index = (byte >> (8 - width * (i + 1))) & ((1 << width) - 1);
+            valid[byte] &= index < alphabet_power;
+            expansions[byte][i] = static_cast<char>(symbols[std::min(index, alphabet_power - 1)]);
+        }
+    }
+
+    size_t bytes = (size + per_byte - 1) / per_byte;
+    for (size_t i = 0; i < bytes; ++i) {
+        if (!valid[packed[i]]) {
+            throw std::runtime_error("Corrupted compressed data!");
+        }
+        size_t count = std::min<size_t>(per_byte, size - i * per_byte);
+        std::memcpy(output + i * per_byte, expansions[packed[i]].data(), count);
+    }
+}
+
+size_t decode_packed(const uint8_t* payload, size_t payload_size, char* output, size_t raw_size) {
+    int alphabet_power = payload_size != 0 ? payload[0] : 0;
+    if (alphabet_power < 2 || alphabet_power > kMaxPackedAlphabet ||
+        payload_size != packed_size(alphabet_power, raw_size)) {
+        throw std::runtime_error("Corrupted packed block!");
+    }
+
+    const uint8_t* symbols = payload + 1;
+    const uint8_t* packed = symbols + alphabet_power;
+    if (packed_width(alphabet_power) == 1) {
+        expand_packed<1>(symbols, alphabet_power, packed, output, raw_size);
+    } else {
+        expand_packed<2>(symbols, alphabet_power, packed, output, raw_size);
+    }
+    return 1 + alphabet_power;
+}
+
+// rounds of reassigning contexts to tables and recounting the tables
+constexpr int kClusterRounds = 4;
+
+// contexts of a block grouped into tables
+struct context_clusters {
+    std::array<uint8_t, 256> tables;
+    std::vector<code_lengths> lengths;
+    uint64_t bit_length;
+    size_t size;
+};
+
+// the bytes following every context, as (symbol, count) pairs
+using context_row = std::vector<std::pair<uint8_t, uint32_t>>;
+
+// k-means over the contexts, seeded with the table_count busiest ones: every context moves to the table
+// that codes its row in the fewest bits, then every table is recounted from its contexts
+context_clusters cluster_contexts(
+    const std::vector<context_row>& rows,
+    const std::vector<int>& contexts,
+    int table_count,
+    int max_code_length
+) {
+    std::vector<std::array<uint64_t, 256>> counts(table_count);
+    std::array<uint8_t, 256> tables{};
+    for (int table = 0; table < table_count; ++table) {
+        counts[table].fill(0);
+        tables[contexts[table]] = table;
+        for (auto [symbol, count] : rows[contexts[table]]) {
+            counts[table][symbol] = count;
+        }
+    }
+
+    std::vector<std::array<float, 256>> costs(table_count);
+    for (int round = 0; round < kClusterRounds; ++round) {
+        // bits of every symbol under every table, smoothed so that unseen symbols aren't free to add
+        for (int table = 0; table < table_count; ++table) {
+            uint64_t total = 0;
+            for (uint64_t count : counts[table]) {
+                total += count;
+            }
+            for (int symbol = 0; symbol < 256; ++symbol) {
+                costs[table][symbol] = std::log2((total + 128.0) / (counts[table][symbol] + 0.5));
+            }
+        }
+
+        for (int context : contexts) {
+            float best_cost = 0;
+            for (int table = 0; table < table_count; ++table) {
+                float cost = 0;
+                for (auto [symbol, count] : rows[context]) {
+                    cost += count * costs[table][symbol];
+                }
+                if (table == 0 || cost < best_cost) {
+                    best_cost = cost;
+                    tables[context] = table;
+                }
+            }
+        }
+
+        for (std::array<uint64_t, 256>& table_counts : counts) {
+            table_counts.fill(0);
+        }
+        for (int context : contexts) {
+            for (auto [symbol, count] : rows[context]) {
+                counts[tables[context]][symbol] += count;
+            }
+        }
+    }
+
+    // tables left without contexts are dropped, contexts that never occur share the first table
+    std::array<int, kMaxContextTables> renumbered{};
+    context_clusters clusters;
+    clusters.bit_length = 0;
+    clusters.size = 1 + kContextMapSize;
+    for (int table = 0; table < table_count; ++table) {
+        renumbered[table] = clusters.lengths.size();
+        if (std::all_of(counts[table].begin(), counts[table].end(), [](uint64_t count) { return count == 0; })) {
+            continue;
+        }
+
+        code_lengths& lengths = clusters.lengths.emplace_back();
+        build_code_lengths(counts[table].data(), lengths.size(), lengths.data(), max_code_length);
+        for (int symbol = 0; symbol < 256; ++symbol) {
+            clusters.bit_length += counts[table][symbol] * lengths[symbol];
+        }
+        clusters.size += packed_code_lengths_size(lengths);
+    }
+    clusters.size += (clusters.bit_length + 7) / 8;
+
+    clusters.tables.fill(0);
+    for (int context : contexts) {
+        clusters.tables[context] = renumbered[tables[context]];
+    }
+    return clusters;
+}
+
+// packs every byte with the code of the table its previous byte selects, the first byte with byte 0's.
+// codes holds 256 codes per table, offsets the first code of every context's table
+size_t encode_context_bits(
+    const uint8_t* data,
+    size_t size,
+    const std::vector<huffman_code>& codes,
+    const std::array<uint16_t, 256>& offsets,
+    int max_length,
+    uint8_t* output
+) {
+    bit_writer writer(output);
+    const uint8_t* end = data + size;
+    uint8_t previous = 0;
+
+    const int codes_per_flush = 57 / std::max(max_length, 1);
+    while (end - data >= codes_per_flush) {
+        for (int i = 0; i < codes_per_flush; ++i) {
+            writer.put(codes[offsets[previous] + *data]);
+            previous = *data++;
+        }
+        writer.flush();
+    }
+    while (data != end) {
+        writer.put(codes[offsets[previous] + *data]);
+        previous = *data++;
+        writer.flush();
+    }
+
+    return writer.finish();
+}
+
+void append_context(const uint8_t* data, size_t size, const block_plan& plan, encoded_block& block) {
+    std::vector<uint8_t>& payload = block.payload;
+    payload.push_back(static_cast<uint8_t>(plan.context_lengths.size()));
+    size_t map = payload.size();
+    payload.resize(map + kContextMapSize, 0);
+    for (int context = 0; context < 256; ++context) {
+        payload[map + context / 2] |= plan.context_tables[context] << (context % 2 == 0 ? 4 : 0);
+    }
+
+    std::vector<huffman_code> codes;
+    int max_length = 0;
+    for (const code_lengths& lengths : plan.context_lengths) {
+        pack_code_lengths(lengths, payload);
+        std::array<huffman_code, 256> table_codes = build_canonical_codes(lengths);
+        codes.insert(codes.end(), table_codes.begin(), table_codes.end());
+        max_length = std::max<int>(max_length, *std::max_element(lengths.begin(), lengths.end()));
+    }
+    std::array<uint16_t, 256> offsets;
+    for (int context = 0; context < 256; ++context) {
+        offsets[context] = plan.context_tables[context] * 256;
+    }
+
+    block.metadata_size = payload.size();
+    payload.resize(block.metadata_size + (plan.bit_length + 7) / 8 + 8);
+    size_t written = encode_context_bits(data, size, codes, offsets, max_length, payload.data() + block.metadata_size);
+    payload.resize(block.metadata_size + written);
+}
+
+size_t decode_context(const uint8_t* payload, size_t payload_size, char* output, size_t raw_size) {
+    int table_count = payload_size != 0 ? payload[0] : 0;
+    if (table_count < 1 || table_count > kMaxContextTables || payload_size < 1 + kContextMapSize) {
+        throw std::runtime_error("Corrupted context block!");
+    }
+
+    std::array<decode_table, kMaxContextTables> tables;
+    size_t offset = 1 + kContextMapSize;
+    for (int table = 0; table < table_count; ++table) {
+        code_lengths lengths;
+        offset += unpack_code_lengths(payload + offset, payload_size - offset, lengths);
+        if (!tables[table].build(lengths)) {
+            throw std::runtime_error("Corrupted code lengths header!");
+        }
+    }
+
+    std::array<const decode_table*, 256> context_tables;
+    for (int context = 0; context < 256; ++context) {
+        int table = (payload[1 + context / 2] >> (context % 2 == 0 ? 4 : 0)) & 0x0f;
+        if (table >= table_count) {
+            throw std::runtime_error("Corrupted context block!");
+        }
+        context_tables[context] = &tables[table];
+    }
+
+    decode_table::decode(context_tables, payload + offset, payload_size - offset, output, raw_size);
+    return offset;
+}
+
+// values below this are their own code in lz blocks
+constexpr uint32_t kLzDirectValues = 16;
+
+int value_code(uint32_t value) { return value < kLzDirectValues ? value : 12 + (31 - __builtin_clz(value)); }
+
+int extra_bits(int code) { return code < int(kLzDirectValues) ? 0 : code - 12; }
+
+// a code of up to 32 bits and up to 31 extra bits don't fit the register together, each is flushed on its own
+void put_value(bit_writer& writer, const std::array<huffman_code, 256>& codes, uint32_t value) {
+    int code = value_code(value);
+    writer.put(codes[code]);
+    writer.flush();
+    if (extra_bits(code) != 0) {
+        int extra = extra_bits(code);
+        writer.put({value & ((uint32_t(1) << extra) - 1), static_cast<uint8_t>(extra)});
+        writer.flush();
+    }
+}
+
+// the reader is refilled for the code, and again for the extra bits when a long code left too few
+uint32_t read_value(const decode_table& table, bit_reader& reader) {
+    reader.refill();
+    int code = static_cast<uint8_t>(table.decode_next(reader));
+    int extra = extra_bits(code);
+    if (extra == 0) {
+        return code;
+    }
+    if (extra > reader.get_available_bits()) {
+        reader.refill();
+    }
+    if (extra > 31 || extra > reader.get_available_bits()) {
+        throw std::runtime_error("Corrupted lz block!");
+    }
+    uint32_t value = (uint32_t(1) << extra) | reader.peek(extra);
+    reader.consume(extra);
+    return value;
+}
+
+void append_u32(uint32_t value, std::vector<uint8_t>& payload) {
+    size_t offset = payload.size();
+    payload.resize(offset + sizeof(value));
+    std::memcpy(payload.data() + offset, &value, sizeof(value));
+}
+
+void append_lz(const uint8_t* data, const block_plan& plan, encoded_block& block) {
+    std::vector<uint8_t>& payload = block.payload;
+    std::vector<uint8_t> literals;
+    size_t position = 0;
+    for (const lz_sequence& sequence : plan.sequences) {
+        literals.insert(literals.end(), data + position, data + position + sequence.literal_length);
+        position += sequence.literal_length + sequence.match_length;
+    }
+
+    std::array<std::array<huffman_code, 256>, kLzTables> codes;
+    uint8_t mask = 0;
+    for (int table = 0; table < kLzTables; ++table) {
+        const code_lengths& lengths = plan.lz_lengths[table];
+        mask |= (*std::max_element(lengths.begin(), lengths.end()) != 0) << table;
+        codes[table] = build_canonical_codes(lengths);
+    }
+    payload.push_back(mask);
+    append_u32(plan.sequences.size(), payload);
+    append_u32(literals.size(), payload);
+    for (int table = 0; table < kLzTables; ++table) {
+        if (mask & (1 << table)) {
+            pack_code_lengths(plan.lz_lengths[table], payload);
+        }
+    }
+
+    // the size slot is filled in once the literals are encoded
+    size_t literal_size_offset = payload.size();
+    append_u32(0, payload);
+    block.metadata_size = payload.size();
+
+    size_t written = payload.size();
+    payload.resize(written + (plan.bit_length + 7) / 8 + 2 * 8);
+    const code_lengths& literal_lengths = plan.lz_lengths[0];
+    int literal_max_length = *std::max_element(literal_lengths.begin(), literal_lengths.end());
+    uint32_t literal_size =
+        encode_bits(literals.data(), literals.size(), codes[0], literal_max_length, payload.data() + written);
+    std::memcpy(payload.data() + literal_size_offset, &literal_size, sizeof(literal_size));
+    written += literal_size;
+
+    bit_writer writer(payload.data() + written);
+    for (const lz_sequence& sequence : plan.sequences) {
+        put_value(writer, codes[1], sequence.literal_length);
+        put_value(writer, codes[2], sequence.match_length);
+        if (sequence.match_length != 0) {
+            put_value(writer, codes[3], sequence.distance);
+        }
+    }
+    payload.resize(written + writer.finish());
+}
+
+size_t decode_lz(const uint8_t* payload, size_t payload_size, char* output, size_t raw_size) {
+    uint32_t sequence_count, literal_count;
+    if (payload_size < 1 + 2 * sizeof(uint32_t) || payload[0] >= (1 << kLzTables)) {
+        throw std::runtime_error("Corrupted lz block!");
+    }
+    uint8_t mask = payload[0];
+    std::memcpy(&sequence_count, payload + 1, sizeof(sequence_count));
+    std::memcpy(&literal_count, payload + 1 + sizeof(sequence_count), sizeof(literal_count));
+
+    size_t offset = 1 + 2 * sizeof(uint32_t);
+    std::array<decode_table, kLzTables> tables;
+    for (int table = 0; table < kLzTables; ++table) {
+        if (mask & (1 << table)) {
+            code_lengths lengths;
+            offset += unpack_code_lengths(payload + offset, payload_size - offset, lengths);
+            if (!tables[table].build(lengths)) {
+                throw std::runtime_error("Corrupted code lengths header!");
+            }
+        }
+    }
+
+    // runs and match lengths are read for every sequence, distances only once a match turns up
+    uint32_t literal_size;
+    if ((literal_count != 0 && !(mask & 1)) || (sequence_count != 0 && (mask & 6) != 6) || literal_count > raw_size ||
+        payload_size - offset < sizeof(literal_size)) {
+        throw std::runtime_error("Corrupted lz block!");
+    }
+    std::memcpy(&literal_size, payload + offset, sizeof(literal_size));
+    offset += sizeof(literal_size);
+    size_t metadata_size = offset;
+    if (literal_size > payload_size - offset) {
+        throw std::runtime_error("Corrupted lz block!");
+    }
+
+    std::vector<char> literals(literal_count);
+    if (literal_count != 0) {
+        tables[0].decode(payload + offset, literal_size, literals.data(), literal_count);
+    }
+    offset += literal_size;
+
+    bit_reader reader(payload + offset, payload_size - offset);
+    const char* literal = literals.data();
+    const char* literal_end = literal + literals.size();
+    char* position = output;
+    char* end = output + raw_size;
+    for (uint32_t i = 0; i < sequence_count; ++i) {
+        uint32_t literal_length = read_value(tables[1], reader);
+        uint32_t match_length = read_value(tables[2], reader);
+        if (literal_length > literal_end - literal || literal_length > end - position) {
+            throw std::runtime_error("Corrupted lz block!");
+        }
+        std::memcpy(position, literal, literal_length);
+        position += literal_length;
+        literal += literal_length;
+        if (match_length == 0) {
+            continue;
+        }
+
+        if (!(mask & 8)) {
+            throw std::runtime_error("Corrupted lz block!");
+        }
+        uint32_t distance = read_value(tables[3], reader);
+        if (distance == 0 || distance > position - output || match_length > end - position) {
+            throw std::runtime_error("Corrupted lz block!");
+        }
+        const char* source = position - distance;
+        if (distance >= match_length) {
+            std::memcpy(position, source, match_length);
+        } else {
+            // the match overlaps its own output, every byte may be one the match just wrote
+            for (uint32_t j = 0; j < match_length; ++j) {
+                position[j] = source[j];
+            }
+        }
+        position += match_length;
+    }
+
+    if (position != end || literal != literal_end || reader.get_consumed_bits() > (payload_size - offset) * 8) {
+        throw std::runtime_error("Corrupted lz block!");
+    }
+    return metadata_size;
+}
+
+}  // namespace
+
+block_plan count_block(const uint8_t* data, size_t size) {
+    block_plan plan;
+    plan.counts.add(data, size);
+    plan.lengths.fill(0);
+    return plan;
+}
+
+void plan_table(
+    block_plan& plan,
+    size_t size,
+    int max_code_length,
+    int streams,
+    const code_lengths* previous_lengths
+) {
+    plan.lengths.fill(0);
+    int alphabet_power = plan.counts.get_alphabet_power();
+    if (alphabet_power == 1) {
+        plan.type = block_type::run;
+        plan.bit_length = 0;
+        plan.size = 1;
+        return;
+    }
+
+    // the block's own table, and the stream table unless it's a single stream
+    size_t overhead = streams != 1 ? stream_table_size(streams) + streams - 1 : 0;
+    double entropy_size = plan.counts.get_entropy_bits() / 8 + min_packed_code_lengths_size(alphabet_power);
+
+    // the previous table is taken without building one when neither the entropy with the smallest table,
+    // nor the raw bytes, nor a packed block could beat it. a byte of margin covers the rounding of the entropy
+    uint64_t bits;
+    if (previous_lengths != nullptr && count_bits(plan.counts, *previous_lengths, bits)) {
+        size_t reuse_size = repeat_size(bits, streams);
+        bool packed = alphabet_power <= kMaxPackedAlphabet && packed_size(alphabet_power, size) < reuse_size;
+        if (reuse_size + 1 <= entropy_size + overhead && reuse_size <= size && !packed) {
+            plan.type = block_type::repeat;
+            plan.lengths = *previous_lengths;
+            plan.bit_length = bits;
+            plan.size = reuse_size;
+            return;
+        }
+    }
+
+    // not even the entropy with the smallest table beats the raw bytes, so the code isn't worth building
+    if (alphabet_power == 0 || entropy_size + overhead >= size) {
+        store_raw(plan, size);
+    } else {
+        plan.type = streams == 1 ? block_type::huffman : block_type::interleaved;
+        const uint64_t* counts = plan.counts.get_counts().data();
+        build_code_lengths(counts, plan.lengths.size(), plan.lengths.data(), max_code_length);
+        count_bits(plan.counts, plan.lengths, plan.bit_length);
+        plan.size = packed_code_lengths_size(plan.lengths) + (plan.bit_length + 7) / 8 + overhead;
+
+        // the estimate can't see the rounding of real code lengths
+        if (plan.size >= size) {
+            store_raw(plan, size);
+        }
+    }
+
+    // a few symbols at a fixed width decode a whole byte at a time, taken whenever that's no larger
+    if (alphabet_power >= 2 && alphabet_power <= kMaxPackedAlphabet && packed_size(alphabet_power, size) <= plan.size) {
+        plan.type = block_type::packed;
+        plan.lengths.fill(0);
+        plan.bit_length = uint64_t(size) * packed_width(alphabet_power);
+        plan.size = packed_size(alphabet_power, size);
+    }
+}
+
+block_plan plan_block(const uint8_t* data, size_t size, int max_code_length, int streams) {
+    block_plan plan = count_block(data, size);
+    plan_table(plan, size, max_code_length, streams);
+    return plan;
+}
+
+void choose_context_model(block_plan& plan, const uint8_t* data, size_t size, int max_code_length) {
+    if (plan.counts.get_alphabet_power() < 2) {
+        return;
+    }
+
+    std::vector<context_row> rows(256);
+    {
+        std::vector<uint32_t> pairs(256 * 256);
+        uint8_t previous = 0;
+        for (size_t i = 0; i < size; ++i) {
+            pairs[previous * 256 + data[i]] += 1;
+            previous = data[i];
+        }
+        for (int context = 0; context < 256; ++context) {
+            for (int symbol = 0; symbol < 256; ++symbol) {
+                if (pairs[context * 256 + symbol] != 0) {
+                    rows[context].emplace_back(symbol, pairs[context * 256 + symbol]);
+                }
+            }
+        }
+    }
+
+    // busiest contexts first, they seed the tables
+    std::vector<uint64_t> totals(256);
+    std::vector<int> contexts;
+    for (int context = 0; context < 256; ++context) {
+        for (auto [symbol, count] : rows[context]) {
+            totals[context] += count;
+        }
+        if (totals[context] != 0) {
+            contexts.push_back(context);
+        }
+    }
+    std::stable_sort(contexts.begin(), contexts.end(), [&](int a, int b) { return totals[a] > totals[b]; });
+
+    // more tables fit the data closer but cost a header each, so a few counts are tried
+    int table_count = std::min<int>(kMaxContextTables, contexts.size());
+    for (; table_count >= 2; table_count /= 2) {
+        context_clusters clusters = cluster_contexts(rows, contexts, table_count, max_code_length);
+        if (clusters.size < plan.size) {
+            plan.type = block_type::context;
+            plan.lengths.fill(0);
+            plan.bit_length = clusters.bit_length;
+            plan.size = clusters.size;
+            plan.context_tables = clusters.tables;
+            plan.context_lengths = std::move(clusters.lengths);
+        }
+    }
+}
+
+void choose_lz(block_plan& plan, const uint8_t* data, size_t size, int level, int max_code_length) {
+    if (plan.type == block_type::run || size < kLzMinMatch) {
+        return;
+    }
+
+    std::vector<lz_sequence> sequences;
+    find_matches(data, size, level, sequences);
+    if (sequences.size() == 1 && sequences[0].match_length == 0) {
+        return;
+    }
+
+    std::array<std::array<uint64_t, 256>, kLzTables> counts{};
+    uint64_t extra = 0;
+    size_t literal_count = 0, position = 0;
+    for (const lz_sequence& sequence : sequences) {
+        const uint8_t* literals = data + position;
+        for (uint32_t i = 0; i < sequence.literal_length; ++i) {
+            counts[0][literals[i]] += 1;
+        }
+        literal_count += sequence.literal_length;
+        position += sequence.literal_length + sequence.match_length;
+
+        uint32_t values[] = {sequence.literal_length, sequence.match_length, sequence.distance};
+        for (int table = 1; table < (sequence.match_length != 0 ? 4 : 3); ++table) {
+            int code = value_code(values[table - 1]);
+            counts[table][code] += 1;
+            extra += extra_bits(code);
+        }
+    }
+
+    std::array<code_lengths, kLzTables> lengths{};
+    uint64_t literal_bits = 0, sequence_bits = extra;
+    size_t payload_size = 1 + 3 * sizeof(uint32_t);
+    for (int table = 0; table < kLzTables; ++table) {
+        if (std::all_of(counts[table].begin(), counts[table].end(), [](uint64_t count) { return count == 0; })) {
+            continue;
+        }
+        build_code_lengths(counts[table].data(), lengths[table].size(), lengths[table].data(), max_code_length);
+        payload_size += packed_code_lengths_size(lengths[table]);
+        for (int symbol = 0; symbol < 256; ++symbol) {
+            (table == 0 ? literal_bits : sequence_bits) += counts[table][symbol] * lengths[table][symbol];
+        }
+    }
+    payload_size += (literal_bits + 7) / 8 + (sequence_bits + 7) / 8;
+
+    if (payload_size < plan.size) {
+        plan.type = block_type::lz;
+        plan.lengths.fill(0);
+        plan.bit_length = literal_bits + sequence_bits;
+        plan.size = payload_size;
+        plan.sequences = std::move(sequences);
+        plan.lz_lengths = lengths;
+    }
+}
+
+void choose_table(
+    block_plan& plan,
+    int streams,
+    const dictionary* shared_table,
+    const code_lengths* previous_lengths
+) {
+    uint64_t bits;
+    if (shared_table != nullptr && count_bits(plan.counts, shared_table->get_code_lengths(), bits)) {
+        size_t size = sizeof(uint32_t) + (bits + 7) / 8;
+        if (size <= plan.size) {
+            plan.type = block_type::dictionary;
+            plan.lengths = shared_table->get_code_lengths();
+            plan.bit_length = bits;
+            plan.size = size;
+        }
+    }
+    if (previous_lengths != nullptr && count_bits(plan.counts, *previous_lengths, bits)) {
+        size_t size = repeat_size(bits, streams);
+        if (size <= plan.size) {
+            plan.type = block_type::repeat;
+            plan.lengths = *previous_lengths;
+            plan.bit_length = bits;
+            plan.size = size;
+        }
+    }
+}
+
+void encode_planned(
+    const uint8_t* data,
+    size_t size,
+    const block_plan& plan,
+    int streams,
+    const dictionary* shared_table,
+    encoded_block& block,
+    uint32_t seek_interval
+) {
+    block.type = plan.type;
+    block.raw_size = static_cast<uint32_t>(size);
+    block.bit_length = plan.bit_length;
+    block.payload.clear();
+    block.seek_points.clear();
+
+    if (plan.type == block_type::stored) {
+        block.payload.assign(data, data + size);
+        block.metadata_size = 0;
+        return;
+    }
+    if (plan.type == block_type::run) {
+        block.payload.push_back(data[0]);
+        block.metadata_size = 1;
+        return;
+    }
+    if (plan.type == block_type::packed) {
+        append_packed(data, size, plan.counts, block.payload);
+        block.metadata_size = 1 + block.payload[0];
+        return;
+    }
+    if (plan.type == block_type::context) {
+        append_context(data, size, plan, block);
+        return;
+    }
+    if (plan.type == block_type::lz) {
+        append_lz(data, plan, block);
+        return;
+    }
+
+    std::array<huffman_code, 256> codes =
+        plan.type == block_type::dictionary ? shared_table->get_codes() : build_canonical_codes(plan.lengths);
+    int max_length = *std::max_element(plan.lengths.begin(), plan.lengths.end());
+
+    if (plan.type == block_type::dictionary) {
+        uint32_t id = shared_table->get_id();
+        block.payload.resize(sizeof(id));
+        std::memcpy(block.payload.data(), &id, sizeof(id));
+    } else if (plan.type != block_type::repeat) {
+        pack_code_lengths(plan.lengths, block.payload);
+    }
+    block.metadata_size = block.payload.size();
+
+    bool single_stream = plan.type == block_type::huffman || plan.type == block_type::dictionary;
+    if (seek_interval != 0) {
+        add_seek_points(data, size, codes, single_stream ? 1 : streams, seek_interval, block.seek_points);
+    }
+    if (single_stream) {
+        block.payload.resize(block.metadata_size + (block.bit_length + 7) / 8 + 8);
+        size_t written = encode_bits(data, size, codes, max_length, block.payload.data() + block.metadata_size);
+        block.payload.resize(block.metadata_size + written);
+        return;
+    }
+    append_streams(data, size, codes, max_length, block.bit_length, streams, block.payload);
+    block.metadata_size += stream_table_size(streams);
+}
+
+encoded_block encode_block(
+    const uint8_t* data,
+    size_t size,
+    int max_code_length,
+    int streams,
+    const dictionary* shared_table
+) {
+    encoded_block block;
+    encode_block(data, size, max_code_length, streams, block, shared_table);
+    return block;
+}
+
+void encode_block(
+    const uint8_t* data,
+    size_t size,
+    int max_code_length,
+    int streams,
+    encoded_block& block,
+    const dictionary* shared_table
+) {
+    block_plan plan = plan_block(data, size, max_code_length, streams);
+    choose_table(plan, streams, shared_table, nullptr);
+    encode_planned(data, size, plan, streams, shared_table, block);
+}
+
+bool is_seekable(block_type type) {
+    return type == block_type::stored || type == block_type::run || type == block_type::huffman ||
+           type == block_type::interleaved || type == block_type::dictionary || type == block_type::repeat;
+}
+
+size_t decode_block_range(
+    block_type type,
+    const uint8_t* payload,
+    size_t payload_size,
+    char* output,
+    size_t raw_size,
+    size_t begin,
+    size_t end,
+    decode_table& table,
+    const dictionary* shared_table,
+    const code_lengths* previous_lengths,
+    uint32_t seek_interval,
+    const std::vector<uint64_t>& seek_points
+) {
+    if (!is_seekable(type) || begin > end || end > raw_size) {
+        throw std::runtime_error("Block can't be decoded in part!");
+    }
+    if (type == block_type::stored || type == block_type::run) {
+        // whole-block checks are all there is, and the copy is cheap
+        return decode_block(type, payload, payload_size, output, raw_size, table, shared_table, previous_lengths);
+    }
+
+    // the code table and where the bitstreams start, as decode_block finds them
+    const decode_table* codes = &table;
+    size_t metadata_size = 0;
+    if (type == block_type::dictionary) {
+        uint32_t id;
+        if (payload_size < sizeof(id)) {
+            throw std::runtime_error("Corrupted dictionary block!");
+        }
+        std::memcpy(&id, payload, sizeof(id));
+        if (shared_table == nullptr || shared_table->get_id() != id) {
+            throw std::runtime_error("Archive needs a different dictionary!");
+        }
+        codes = &shared_table->get_decode_table();
+        metadata_size = sizeof(id);
+    } else if (type == block_type::repeat) {
+        if (previous_lengths == nullptr || !table.build(*previous_lengths)) {
+            throw std::runtime_error("Repeated code table is missing!");
+        }
+    } else {
+        std::array<uint8_t, 256> lengths;
+        metadata_size = unpack_code_lengths(payload, payload_size, lengths);
+        if (!table.build(lengths)) {
+            throw std::runtime_error("Corrupted code lengths header!");
+        }
+    }
+
+    std::array<decode_stream, kMaxStreams> spans;
+    int streams = 1;
+    if (type == block_type::huffman || type == block_type::dictionary) {
+        spans[0] = {payload + metadata_size, payload_size - metadata_size, output, raw_size};
+    } else {
+        if (type == block_type::interleaved && (metadata_size == payload_size || payload[metadata_size] < 2)) {
+            throw std::runtime_error("Corrupted stream table!");
+        }
+        streams = parse_streams(payload + metadata_size, payload_size - metadata_size, output, raw_size, spans);
+        metadata_size += stream_table_size(streams);
+    }
+
+    for (int stream = 0; stream < streams; ++stream) {
+        size_t stream_begin = spans[stream].output - output;
+        size_t stream_end = stream_begin + spans[stream].count;
+        if (stream_end <= begin || stream_begin >= end) {
+            continue;
+        }
+
+        // the nearest seek point at or before begin that lies in this stream's segment
+        size_t start = stream_begin;
+        uint64_t bit_offset = 0;
+        if (seek_interval != 0) {
+            size_t point = std::min<size_t>(std::max(begin, stream_begin) / seek_interval, seek_points.size());
+            if (point != 0 && point * seek_interval > stream_begin) {
+                start = point * seek_interval;
+                bit_offset = seek_points[point - 1];
+            }
+        }
+        size_t stop = std::min(end, stream_end);
+        if (bit_offset > spans[stream].size * 8) {
+            throw std::runtime_error("Corrupted seek point!");
+        }
+        codes->decode(spans[stream].data, spans[stream].size, bit_offset, output + start, stop - start);
+    }
+    return metadata_size;
+}
+
+bool read_code_lengths(block_type type, const uint8_t* payload, size_t payload_size, code_lengths& lengths) {
+    if (type != block_type::huffman && type != block_type::interleaved) {
+        return false;
+    }
+    unpack_code_lengths(payload, payload_size, lengths);
+    return true;
+}
+
+size_t decode_block(block_type type, const uint8_t* payload, size_t payload_size, char* output, size_t raw_size) {
+    decode_table table;
+    return decode_block(type, payload, payload_size, output, raw_size, table);
+}
+
+size_t decode_block(
+    block_type type,
+    const uint8_t* payload,
+    size_t payload_size,
+    char* output,
+    size_t raw_size,
+    decode_table& table,
+    const dictionary* shared_table,
+    const code_lengths* previous_lengths
+) {
+    if (type == block_type::dictionary) {
+        uint32_t id;
+        if (payload_size < sizeof(id)) {
+            throw std::runtime_error("Corrupted dictionary block!");
+        }
+        std::memcpy(&id, payload, sizeof(id));
+        if (shared_table == nullptr || shared_table->get_id() != id) {
+            throw std::runtime_error("Archive needs a different dictionary!");
+        }
+        shared_table->get_decode_table().decode(payload + sizeof(id), payload_size - sizeof(id), output, raw_size);
+        return sizeof(id);
+    }
+    if (type == block_type::stored) {
+        if (payload_size != raw_size) {
+            throw std::runtime_error("Corrupted stored block!");
+        }
+        std::memcpy(output, payload, raw_size);
+        return 0;
+    }
+    if (type == block_type::run) {
+        if (payload_size != 1) {
+            throw std::runtime_error("Corrupted run block!");
+        }
+        std::memset(output, payload[0], raw_size);
+        return 1;
+    }
+    if (type == block_type::packed) {
+        return decode_packed(payload, payload_size, output, raw_size);
+    }
+    if (type == block_type::context) {
+        return decode_context(payload, payload_size, output, raw_size);
+    }
+    if (type == block_type::lz) {
+        return decode_lz(payload, payload_size, output, raw_size);
+    }
+    if (type == block_type::repeat) {
+        if (previous_lengths == nullptr || !table.build(*previous_lengths)) {
+            throw std::runtime_error("Repeated code table is missing!");
+        }
+        return decode_streams(table, payload, payload_size, output, raw_size);
+    }
+    if (type != block_type::huffman && type != block_type::interleaved) {
+        throw std::runtime_error("Unknown block type!");
+    }
+
+    std::array<uint8_t, 256> lengths;
+    size_t header_size = unpack_code_lengths(payload, payload_size, lengths);
+
+    if (!table.build(lengths)) {
+        throw std::runtime_error("Corrupted code lengths header!");
+    }
+    if (type == block_type::huffman) {
+        table.decode(payload + header_size, payload_size - header_size, output, raw_size);
+        return header_size;
+    }
+
+    if (header_size == payload_size || payload[header_size] < 2) {
+        throw std::runtime_error("Corrupted stream table!");
+    }
+    return header_size + decode_streams(table, payload + header_size, payload_size - header_size, output, raw_size);
+}
+
+}  // namespace huffman
@@ -0,0 +1,54 @@
+#include "checksum.h"
+
+#include <array>
+#include <cstring>
+
+namespace huffman {
+
+namespace {
+
+constexpr uint32_t kPolynomial = 0xedb88320;
+
+// table k gives the crc of a byte followed by k zero bytes, so eight bytes are folded in at once
+struct crc_tables {
+    std::array<std::array<uint32_t, 256>, 8> tables;
+
+    crc_tables() {
+        for (uint32_t byte = 0; byte < 256; ++byte) {
+            uint32_t crc = byte;
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = (crc >> 1) ^ (crc & 1 ? kPolynomial : 0);
+            }
+            tables[0][byte] = crc;
+        }
+        for (int table = 1; table < 8; ++table) {
+            for (int byte = 0; byte < 256; ++byte) {
+                uint32_t previous = tables[table - 1][byte];
+                tables[table][byte] = (previous >> 8) ^ tables[0][previous & 0xff];
+            }
+        }
+    }
+};
+
+const crc_tables kTables;
+
+}  // namespace
+
+uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc) {
+    const auto& t = kTables.tables;
+    crc = ~crc;
+    for (; size >= 8; data += 8, size -= 8) {
+        uint32_t low, high;
+        std::memcpy(&low, data, sizeof(low));
+        std::memcpy(&high, data + 4, sizeof(high));
+        low ^= crc;
+        crc = t[7][low & 0xff] ^ t[6][(low >> 8) & 0xff] ^ t[5][(low >> 16) & 0xff] ^ t[4][low >> 24] ^
+              t[3][high & 0xff] ^ t[2][(high >> 8) & 0xff] ^ t[1][(high >> 16) & 0xff] ^ t[0][high >> 24];
+    }
+    for (; size != 0; ++data, --size) {
+        crc = (crc >> 8) ^ t[0][(crc ^ *data) & 0xff];
+    }
+    return ~crc;
+}
+
+}  // namespace huffman
@@ -0,0 +1,205 @@
+#include "decode_table.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include "bit_stream.h"
+#include "huffman_tree.h"
+
+namespace huffman {
+
+bool decode_table::build(const std::map<char, std::string>& table) {
+    std::vector<code>& codes = codes_;
+    codes.clear();
+    for (const auto& element : table) {
+        int length = element.second.size();
+        if (length == 0 || length > kMaxCodeLength) {
+            return false;
+        }
+
+        uint32_t bits = 0;
+        for (char bit : element.second) {
+            bits = (bits << 1) | static_cast<uint32_t>(bit - '0');
+        }
+        codes.push_back({static_cast<uint8_t>(element.first), bits, length});
+    }
+
+    build_entries(codes);
+    return true;
+}
+
+bool decode_table::build(const std::array<uint8_t, 256>& code_lengths) {
+    if (*std::max_element(code_lengths.begin(), code_lengths.end()) > kMaxCodeLength) {
+        return false;
+    }
+
+    std::array<huffman_code, 256> canonical_codes = build_canonical_codes(code_lengths);
+    std::vector<code>& codes = codes_;
+    codes.clear();
+    for (int symbol = 0; symbol < 256; ++symbol) {
+        if (code_lengths[symbol] != 0) {
+            codes.push_back({static_cast<uint8_t>(symbol), canonical_codes[symbol].bits, code_lengths[symbol]});
+        }
+    }
+
+    build_entries(codes);
+    return true;
+}
+
+void decode_table::build_entries(const std::vector<code>& codes) {
+    // kraft sum over 2^kMaxCodeLength, above one the codes would overlap in the table
+    uint64_t kraft_sum = 0;
+    max_code_length_ = 0;
+    for (const code& c : codes) {
+        kraft_sum += uint64_t(1) << (kMaxCodeLength - c.length);
+        max_code_length_ = std::max(max_code_length_, c.length);
+    }
+    if (kraft_sum > (uint64_t(1) << kMaxCodeLength)) {
+        throw std::runtime_error("Corrupted code table!");
+    }
+
+    entries_.assign(size_t(1) << kPrimaryBits, decode_entry{0, 0, 0});
+
+    // longest code under every primary prefix decides the size of its sub-table
+    std::array<uint8_t, size_t(1) << kPrimaryBits> longest{};
+    for (const code& c : codes) {
+        if (c.length > kPrimaryBits) {
+            uint32_t prefix = c.bits >> (c.length - kPrimaryBits);
+            longest[prefix] = std::max<uint8_t>(longest[prefix], c.length);
+        }
+    }
+    for (size_t prefix = 0; prefix < longest.size(); ++prefix) {
+        if (longest[prefix] != 0) {
+            int sub_bits = longest[prefix] - kPrimaryBits;
+            entries_[prefix] = {static_cast<uint32_t>(entries_.size()), 0, static_cast<uint8_t>(sub_bits)};
+            entries_.resize(entries_.size() + (size_t(1) << sub_bits), decode_entry{0, 0, 0});
+        }
+    }
+
+    for (const code& c : codes) {
+        decode_entry entry{c.symbol, static_cast<uint8_t>(c.length), 0};
+        if (c.length <= kPrimaryBits) {
+            size_t first = size_t(c.bits) << (kPrimaryBits - c.length);
+            size_t last = first + (size_t(1) << (kPrimaryBits - c.length));
+            std::fill(entries_.begin() + first, entries_.begin() + last, entry);
+        } else {
+            int tail_length = c.length - kPrimaryBits;
+            const decode_entry& link = entries_[c.bits >> tail_length];
+            uint32_t tail = c.bits & ((uint32_t(1) << tail_length) - 1);
+            size_t first = link.value + (size_t(tail) << (link.sub_bits - tail_length));
+            size_t last = first + (size_t(1) << (link.sub_bits - tail_length));
+            std::fill(entries_.begin() + first, entries_.begin() + last, entry);
+        }
+    }
+}
+
+void decode_table::decode(const uint8_t* data, size_t size, char* output, size_t count) const {
+    decode(data, size, 0, output, count);
+}
+
+void decode_table::decode(const uint8_t* data, size_t size, uint64_t bit_offset, char* output, size_t count) const {
+    if (bit_offset > size * 8) {
+        throw std::runtime_error("Compressed data is truncated!");
+    }
+    data += bit_offset / 8;
+    size -= bit_offset / 8;
+    bit_reader reader(data, size);
+    if (bit_offset % 8 != 0) {
+        reader.refill();
+        reader.consume(bit_offset % 8);
+    }
+    const decode_entry* entries = entries_.data();
+    char* end = output + count;
+
+    while (output != end) {
+        reader.refill();
+
+        // a refill guarantees 56 bits, enough for at least one code of any length
+        do {
+            *output++ = decode_symbol(entries, reader);
+        } while (reader.get_available_bits() >= max_code_length_ && output != end);
+    }
+
+    if (reader.get_consumed_bits() > size * 8) {
+        throw std::runtime_error("Compressed data is truncated!");
+    }
+}
+
+void decode_table::decode(const decode_stream* streams, int stream_count) const {
+    if (stream_count <= 0 || stream_count > kMaxStreams) {
+        throw std::runtime_error("Unsupported stream count!");
+    }
+
+    // every refill leaves room for this many codes in each register
+    const size_t codes_per_refill = 56 / max_code_length_;
+    const decode_entry* entries = entries_.data();
+
+    std::array<bit_reader, kMaxStreams> readers;
+    std::array<char*, kMaxStreams> outputs;
+    size_t lockstep_count = streams[0].count;
+    for (int i = 0; i < stream_count; ++i) {
+        readers[i] = bit_reader(streams[i].data, streams[i].size);
+        outputs[i] = streams[i].output;
+        lockstep_count = std::min(lockstep_count, streams[i].count);
+    }
+
+    // the shortest stream bounds the lockstep part, every stream then finishes on its own
+    size_t decoded = 0;
+    for (; decoded + codes_per_refill <= lockstep_count; decoded += codes_per_refill) {
+        for (int stream = 0; stream < stream_count; ++stream) {
+            readers[stream].refill();
+        }
+        for (size_t i = 0; i < codes_per_refill; ++i) {
+            for (int stream = 0; stream < stream_count; ++stream) {
+                *outputs[stream]++ = decode_symbol(entries, readers[stream]);
+            }
+        }
+    }
+
+    for (int stream = 0; stream < stream_count; ++stream) {
+        bit_reader& reader = readers[stream];
+        for (size_t i = decoded; i < streams[stream].count; ++i) {
+            if (reader.get_available_bits() < max_code_length_) {
+                reader.refill();
+            }
+            *outputs[stream]++ = decode_symbol(entries, reader);
+        }
+        if (reader.get_consumed_bits() > streams[stream].size * 8) {
+            throw std::runtime_error("Compressed data is truncated!");
+        }
+    }
+}
+
+void decode_table::decode(
+    const std::array<const decode_table*, 256>& tables,
+    const uint8_t* data,
+    size_t size,
+    char* output,
+    size_t count
+) {
+    std::array<const decode_entry*, 256> entries;
+    int max_code_length = 1;
+    for (int context = 0; context < 256; ++context) {
+        entries[context] = tables[context]->entries_.data();
+        max_code_length = std::max(max_code_length, tables[context]->max_code_length_);
+    }
+
+    bit_reader reader(data, size);
+    char* end = output + count;
+    uint8_t previous = 0;
+    while (output != end) {
+        reader.refill();
+        do {
+            char symbol = decode_symbol(entries[previous], reader);
+            *output++ = symbol;
+            previous = static_cast<uint8_t>(symbol);
+        } while (reader.get_available_bits() >= max_code_length && output != end);
+    }
+
+    if (reader.get_consumed_bits() > size * 8) {
+        throw std::runtime_error("Compressed data is truncated!");
+    }
+}
+
+int decode_table::get_max_code_length() const { return max_code_length_; }
+
+}  // namespace huffman
@@ -0,0 +1,110 @@
+#include "dictionary.h"
+
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include "archive_format.h"
+#include "huffman_tree.h"
+#include "input_source.h"
+
+namespace huffman {
+
+namespace {
+
+// fnv-1a over the code lengths
+uint32_t hash_code_lengths(const std::array<uint8_t, 256>& code_lengths) {
+    uint32_t hash = 2166136261u;
+    for (uint8_t length : code_lengths) {
+        hash = (hash ^ length) * 16777619u;
+    }
+    return hash;
+}
+
+// every length fits a decode table and the codes don't overlap
+bool is_complete_code(const std::array<uint8_t, 256>& code_lengths) {
+    uint64_t kraft_sum = 0;
+    for (uint8_t length : code_lengths) {
+        if (length == 0 || length > decode_table::kMaxCodeLength) {
+            return false;
+        }
+        kraft_sum += uint64_t(1) << (decode_table::kMaxCodeLength - length);
+    }
+    return kraft_sum <= (uint64_t(1) << decode_table::kMaxCodeLength);
+}
+
+}  // namespace
+
+dictionary::dictionary(const std::array<uint8_t, 256>& code_lengths)
+    : id_(hash_code_lengths(code_lengths)),
+      code_lengths_(code_lengths),
+      codes_(build_canonical_codes(code_lengths)),
+      max_code_length_(*std::max_element(code_lengths.begin(), code_lengths.end())) {
+    if (!table_.build(code_lengths_)) {
+        throw std::runtime_error("Corrupted dictionary!");
+    }
+}
+
+dictionary dictionary::train(const histogram& samples, int max_code_length) {
+    // unseen bytes count once, so they still get a code
+    std::array<uint64_t, 256> counts = samples.get_counts();
+    for (uint64_t& count : counts) {
+        count = std::max<uint64_t>(count, 1);
+    }
+
+    std::array<uint8_t, 256> code_lengths;
+    build_code_lengths(counts.data(), counts.size(), code_lengths.data(), max_code_length);
+    return dictionary(code_lengths);
+}
+
+dictionary dictionary::train(const std::vector<std::string>& sample_files, int max_code_length) {
+    histogram samples;
+    for (const std::string& filename : sample_files) {
+        mapped_file sample(filename);
+        if (!sample.is_mapped()) {
+            std::vector<uint8_t> data = read_file(filename);
+            samples.add(data.data(), data.size());
+            continue;
+        }
+        samples.add(sample.get_data(), sample.get_size());
+    }
+    return train(samples, max_code_length);
+}
+
+dictionary dictionary::load(std::istream& input) {
+    std::array<char, kDictionaryMagic.size()> magic{};
+    uint32_t id;
+    input.read(magic.data(), magic.size());
+    input.read(reinterpret_cast<char*>(&id), sizeof(id));
+    if (!input || magic != kDictionaryMagic) {
+        throw std::runtime_error("Corrupted dictionary!");
+    }
+    std::vector<uint8_t> packed((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+
+    std::array<uint8_t, 256> code_lengths;
+    unpack_code_lengths(packed.data(), packed.size(), code_lengths);
+    if (!is_complete_code(code_lengths) || hash_code_lengths(code_lengths) != id) {
+        throw std::runtime_error("Corrupted dictionary!");
+    }
+    return dictionary(code_lengths);
+}
+
+void dictionary::save(std::ostream& output) const {
+    std::vector<uint8_t> packed;
+    pack_code_lengths(code_lengths_, packed);
+
+    output.write(kDictionaryMagic.data(), kDictionaryMagic.size());
+    output.write(reinterpret_cast<const char*>(&id_), sizeof(id_));
+    output.write(reinterpret_cast<const char*>(packed.data()), packed.size());
+}
+
+uint32_t dictionary::get_id() const { return id_; }
+
+const std::array<uint8_t, 256>& dictionary::get_code_lengths() const { return code_lengths_; }
+
+const std::array<huffman_code, 256>& dictionary::get_codes() const { return codes_; }
+
+int dictionary::get_max_code_length() const { return max_code_length_; }
+
+const decode_table& dictionary::get_decode_table() const { return table_; }
+
+}  // namespace huffman
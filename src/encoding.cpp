@@ -1,12 +1,23 @@
 #include "encoding.h"
 
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <future>
 #include <iostream>
 #include <map>
+#include <stdexcept>
+#include <vector>
+#include "archive_format.h"
+#include "file_output.h"
+#include "input_source.h"
+#include "memory_buffer.h"
+#include "thread_pool.h"
 
 namespace huffman {
 
 // writes power of alphabet and frequency table at the beginning of compressed file
-void binary_io::write_frequency_table(std::ofstream& output, const huffman_tree& tree) {
+void binary_io::write_frequency_table(std::ostream& output, const huffman_tree& tree) {
     frequency_table_size_ = 0;
 
     int alphabet_size = tree.get_alphabet_power();
@@ -25,38 +36,34 @@ void binary_io::write_frequency_table(std::ofstream& output, const huffman_tree&
     not_compressed_file_size_ = number_of_chars;
 }
 
-// pack huffman codes into bytes and write them into result file
-void binary_io::write_bits(std::ofstream& output, std::string source_file, const huffman_tree& tree) {
-    std::map<char, std::string> table = tree.get_table();
-    std::ifstream source(source_file);
-
-    compressed_file_size_ = 0;
-    cur_position_in_byte = 0;
-    char buf = 0;
-    char symbol;
-
-    while (source.get(symbol)) {
-        std::string symbol_code = table[symbol];
-        for (size_t i = 0; i < symbol_code.size(); ++i) {
-            buf |= (symbol_code[i] - 48) << (7 - cur_position_in_byte);  // '0' ascii code = 48
-            cur_position_in_byte += 1;
-
-            if (cur_position_in_byte == 8) {
-                cur_position_in_byte = 0;
-                compressed_file_size_ += 1;
-                output << buf;
-                buf = 0;
-            }
-        }
+void binary_io::write_bits(std::ostream& output, std::string source_file, const huffman_tree& tree) {
+    mapped_file source(source_file);
+    if (!source.is_mapped()) {
+        // pipes and devices are read whole
+        std::vector<uint8_t> data = read_file(source_file);
+        write_bits(output, data.data(), data.size(), tree);
+        return;
     }
+    write_bits(output, source.get_data(), source.get_size(), tree);
+}
 
-    if (cur_position_in_byte != 0) {
-        compressed_file_size_ += 1;
-        output << buf;
+// pack huffman codes into bytes and write them into result file
+void binary_io::write_bits(std::ostream& output, const uint8_t* data, size_t size, const huffman_tree& tree) {
+    std::array<huffman_code, 256> codes = tree.get_codes();
+    histogram counts;
+    counts.add(data, size);
+
+    int max_length = 0;
+    for (const huffman_code& code : codes) {
+        max_length = std::max<int>(max_length, code.length);
     }
+
+    std::vector<uint8_t> packed((count_encoded_bits(counts, codes) + 7) / 8 + 8);
+    compressed_file_size_ = encode_bits(data, size, codes, max_length, packed.data());
+    output.write(reinterpret_cast<const char*>(packed.data()), compressed_file_size_);
 }
 
-void binary_io::read_frequency_table(std::ifstream& input, huffman_tree& tree) {
+void binary_io::read_frequency_table(std::istream& input, huffman_tree& tree) {
     frequency_table_size_ = 0;
 
     int alphabet_power, size_buf, number_buf;
@@ -75,51 +82,316 @@ void binary_io::read_frequency_table(std::ifstream& input, huffman_tree& tree) {
     }
 }
 
-void binary_io::read_bits(std::ifstream& input, huffman_tree& tree, const std::string& filename) {
-    std::ofstream output(filename);
-    char buf;
+// decodes the bitstream with a lookup table built from the code table,
+// codes too long for the table fall back to walking the tree bit by bit
+void binary_io::read_bits(std::istream& input, huffman_tree& tree, std::ostream& output) {
+    std::vector<uint8_t> data = read_remaining(input);
+    decode_table table;
+    if (!table.build(tree.get_table())) {
+        read_bits_tree_walk(data, tree, output);
+        return;
+    }
+
+    write_decoded(data, table, output);
+}
+
+std::vector<uint8_t> binary_io::read_remaining(std::istream& input) {
+    std::streampos data_start = input.tellg();
+    input.seekg(0, std::ios_base::end);
+    std::vector<uint8_t> data(input.tellg() - data_start);
+    input.seekg(data_start);
+    input.read(reinterpret_cast<char*>(data.data()), data.size());
+    compressed_file_size_ = data.size();
+    return data;
+}
+
+void binary_io::write_decoded(
+    const std::vector<uint8_t>& data,
+    const decode_table& table,
+    std::ostream& output
+) {
+    std::vector<char> decoded(not_compressed_file_size_);
+    table.decode(data.data(), data.size(), decoded.data(), decoded.size());
+
+    output.write(decoded.data(), decoded.size());
+}
+
+void binary_io::read_bits_tree_walk(const std::vector<uint8_t>& data, huffman_tree& tree, std::ostream& output) {
     unsigned char bit;
     size_t counter_chars = 0;
     const huffman_tree_node* node = tree.get_root();
-    compressed_file_size_ = 0;
 
-    while (input.get(buf)) {
-        compressed_file_size_ += 1;
+    // symbols gather here and go out in one write, not one stream call each
+    std::vector<char> decoded;
+    decoded.reserve(not_compressed_file_size_);
 
+    for (uint8_t buf : data) {
         for (int j = 7; j >= 0; --j) {
             bit = (buf >> j) & 1;
             if (bit == 0) {
                 node = node->get_left_child();
-            } else if (bit == 1 && tree.get_root()->get_left_child() == nullptr &&
-                       tree.get_root()->get_right_child() == nullptr) {
-                counter_chars += 1;
-                output << node->get_symbol();
-            } else if (bit == 1) {
+            } else {
                 node = node->get_right_child();
             }
 
+            if (node->get_left_child() == nullptr && node->get_right_child() == nullptr) {
+                counter_chars += 1;
+                decoded.push_back(node->get_symbol());
+                node = tree.get_root();
+            }
+
             if (counter_chars == not_compressed_file_size_) {
-                break;
+                output.write(decoded.data(), decoded.size());
+                return;
             }
+        }
+    }
+    output.write(decoded.data(), decoded.size());
+}
 
-            if (node->get_left_child() == nullptr && node->get_right_child() == nullptr && node != tree.get_root()) {
-                counter_chars += 1;
-                output << node->get_symbol();
-                node = tree.get_root();
+void binary_io::write_archive_header(std::ostream& output, uint32_t block_size) {
+    output.write(kArchiveMagic.data(), kArchiveMagic.size());
+    output.write(reinterpret_cast<const char*>(&block_size), sizeof(block_size));
+
+    archive_offset_ = kArchiveHeaderSize;
+    table_block_ = kNoTableBlock;
+    block_index_.clear();
+    seek_points_.clear();
+    not_compressed_file_size_ = 0;
+    compressed_file_size_ = 0;
+    frequency_table_size_ = kArchiveHeaderSize;
+}
+
+void binary_io::write_message_header(std::ostream& output) {
+    output.write(kMessageMagic.data(), kMessageMagic.size());
+
+    archive_offset_ = kMessageHeaderSize;
+    table_block_ = kNoTableBlock;
+    block_index_.clear();
+    seek_points_.clear();
+    not_compressed_file_size_ = 0;
+    compressed_file_size_ = 0;
+    frequency_table_size_ = kMessageHeaderSize;
+}
+
+void binary_io::write_block(std::ostream& output, const encoded_block& block) {
+    uint32_t payload_size = block.payload.size();
+    output.write(reinterpret_cast<const char*>(&block.type), sizeof(block.type));
+    output.write(reinterpret_cast<const char*>(&block.raw_size), sizeof(block.raw_size));
+    output.write(reinterpret_cast<const char*>(&payload_size), sizeof(payload_size));
+    output.write(reinterpret_cast<const char*>(block.payload.data()), payload_size);
+
+    if (block.type == block_type::huffman || block.type == block_type::interleaved) {
+        table_block_ = block_index_.size();
+    }
+    block_index_.push_back({archive_offset_, not_compressed_file_size_, block.bit_length, table_block_});
+    seek_points_.push_back(block.seek_points);
+    archive_offset_ += kBlockHeaderSize + payload_size;
+
+    not_compressed_file_size_ += block.raw_size;
+    compressed_file_size_ += payload_size - block.metadata_size;
+    frequency_table_size_ += kBlockHeaderSize + block.metadata_size;
+}
+
+// end record, then the block index and the trailer pointing at it
+void binary_io::write_block_index(std::ostream& output, uint32_t seek_interval) {
+    block_type end = block_type::end;
+    output.write(reinterpret_cast<const char*>(&end), sizeof(end));
+    uint64_t index_offset = archive_offset_ + sizeof(end);
+
+    uint32_t block_count = block_index_.size();
+    uint64_t raw_size = not_compressed_file_size_;
+    output.write(reinterpret_cast<const char*>(&block_count), sizeof(block_count));
+    output.write(reinterpret_cast<const char*>(&raw_size), sizeof(raw_size));
+    for (const block_index_entry& entry : block_index_) {
+        output.write(reinterpret_cast<const char*>(&entry.compressed_offset), sizeof(entry.compressed_offset));
+        output.write(reinterpret_cast<const char*>(&entry.uncompressed_offset), sizeof(entry.uncompressed_offset));
+        output.write(reinterpret_cast<const char*>(&entry.bit_length), sizeof(entry.bit_length));
+        output.write(reinterpret_cast<const char*>(&entry.table_block), sizeof(entry.table_block));
+    }
+
+    size_t seek_size = 0;
+    if (seek_interval != 0) {
+        output.write(reinterpret_cast<const char*>(&seek_interval), sizeof(seek_interval));
+        seek_size += sizeof(seek_interval);
+        for (const std::vector<uint64_t>& points : seek_points_) {
+            uint32_t point_count = points.size();
+            output.write(reinterpret_cast<const char*>(&point_count), sizeof(point_count));
+            output.write(reinterpret_cast<const char*>(points.data()), point_count * sizeof(uint64_t));
+            seek_size += sizeof(point_count) + point_count * sizeof(uint64_t);
+        }
+    }
+
+    output.write(reinterpret_cast<const char*>(&index_offset), sizeof(index_offset));
+    output.write(kTableIndexMagic.data(), kTableIndexMagic.size());
+
+    frequency_table_size_ += sizeof(end) + sizeof(block_count) + sizeof(raw_size) + block_count * kBlockIndexEntrySize +
+                             seek_size + kTrailerSize;
+}
+
+// checks for the archive and message magics, the stream is left after one when present and rewound otherwise
+archive_kind binary_io::read_magic(std::istream& input) {
+    std::array<char, kArchiveMagic.size()> magic{};
+    if (input.read(magic.data(), magic.size())) {
+        if (magic == kArchiveMagic) {
+            return archive_kind::blocks;
+        }
+        if (magic == kMessageMagic) {
+            not_compressed_file_size_ = 0;
+            compressed_file_size_ = 0;
+            frequency_table_size_ = kMessageHeaderSize;
+            return archive_kind::message;
+        }
+    }
+
+    input.clear();
+    input.seekg(0);
+    return archive_kind::original;
+}
+
+uint32_t binary_io::read_archive_header(std::istream& input) {
+    uint32_t block_size;
+    if (!input.read(reinterpret_cast<char*>(&block_size), sizeof(block_size))) {
+        throw std::runtime_error("Corrupted archive header!");
+    }
+
+    not_compressed_file_size_ = 0;
+    compressed_file_size_ = 0;
+    frequency_table_size_ = kArchiveHeaderSize;
+    return block_size;
+}
+
+bool binary_io::read_block(std::istream& input, block_type& type, uint32_t& raw_size, std::vector<uint8_t>& payload) {
+    if (!input.read(reinterpret_cast<char*>(&type), sizeof(type))) {
+        throw std::runtime_error("Archive is truncated!");
+    }
+    if (type == block_type::end) {
+        return false;
+    }
+
+    uint32_t payload_size;
+    input.read(reinterpret_cast<char*>(&raw_size), sizeof(raw_size));
+    input.read(reinterpret_cast<char*>(&payload_size), sizeof(payload_size));
+    if (!input) {
+        throw std::runtime_error("Archive is truncated!");
+    }
+    // sizes are checked before anything is allocated for them
+    if (raw_size > kMaxBlockSize || payload_size > raw_size + kMaxBlockOverhead) {
+        throw std::runtime_error("Corrupted block header!");
+    }
+    payload.resize(payload_size);
+    if (!input.read(reinterpret_cast<char*>(payload.data()), payload_size)) {
+        throw std::runtime_error("Archive is truncated!");
+    }
+    return true;
+}
+
+bool binary_io::read_block_index(std::istream& input, block_index& index) {
+    std::streampos position = input.tellg();
+    input.seekg(0, std::ios_base::end);
+    uint64_t archive_size = input.tellg();
+
+    uint64_t index_offset = 0;
+    std::array<char, kIndexMagic.size()> magic{};
+    if (archive_size >= kArchiveHeaderSize + 1 + kTrailerSize) {
+        input.seekg(archive_size - kTrailerSize);
+        input.read(reinterpret_cast<char*>(&index_offset), sizeof(index_offset));
+        input.read(magic.data(), magic.size());
+    }
+    if (!input || (magic != kIndexMagic && magic != kTableIndexMagic)) {
+        input.clear();
+        input.seekg(position);
+        return false;
+    }
+    index.has_table_blocks = magic == kTableIndexMagic;
+    size_t entry_size = index.has_table_blocks ? kBlockIndexEntrySize : kBlockIndexEntrySizeWithoutTables;
+
+    uint32_t block_count;
+    input.seekg(index_offset);
+    input.read(reinterpret_cast<char*>(&block_count), sizeof(block_count));
+    input.read(reinterpret_cast<char*>(&index.raw_size), sizeof(index.raw_size));
+    uint64_t entries_offset = index_offset + sizeof(block_count) + sizeof(index.raw_size);
+    uint64_t index_end = archive_size - kTrailerSize;
+    if (!input || index_offset < kArchiveHeaderSize + 1 || entries_offset > index_end ||
+        (index_end - entries_offset) / entry_size < block_count) {
+        throw std::runtime_error("Corrupted block index!");
+    }
+
+    index.blocks_end = index_offset - 1;
+    index.entries.resize(block_count);
+    for (block_index_entry& entry : index.entries) {
+        input.read(reinterpret_cast<char*>(&entry.compressed_offset), sizeof(entry.compressed_offset));
+        input.read(reinterpret_cast<char*>(&entry.uncompressed_offset), sizeof(entry.uncompressed_offset));
+        input.read(reinterpret_cast<char*>(&entry.bit_length), sizeof(entry.bit_length));
+        entry.table_block = kNoTableBlock;
+        if (index.has_table_blocks) {
+            input.read(reinterpret_cast<char*>(&entry.table_block), sizeof(entry.table_block));
+        }
+    }
+
+    // seek points follow the entries when there are any
+    uint64_t seek_offset = entries_offset + block_count * entry_size;
+    index.seek_interval = 0;
+    index.seek_points.clear();
+    if (seek_offset != index_end) {
+        input.read(reinterpret_cast<char*>(&index.seek_interval), sizeof(index.seek_interval));
+        seek_offset += sizeof(index.seek_interval);
+        if (!input || index.seek_interval < kMinSeekInterval || seek_offset > index_end) {
+            throw std::runtime_error("Corrupted block index!");
+        }
+        index.seek_points.resize(block_count);
+        for (std::vector<uint64_t>& points : index.seek_points) {
+            uint32_t point_count = 0;
+            input.read(reinterpret_cast<char*>(&point_count), sizeof(point_count));
+            seek_offset += sizeof(point_count);
+            if (!input || seek_offset > index_end || (index_end - seek_offset) / sizeof(uint64_t) < point_count) {
+                throw std::runtime_error("Corrupted block index!");
             }
+            points.resize(point_count);
+            input.read(reinterpret_cast<char*>(points.data()), point_count * sizeof(uint64_t));
+            seek_offset += point_count * sizeof(uint64_t);
         }
+        if (!input || seek_offset != index_end) {
+            throw std::runtime_error("Corrupted block index!");
+        }
+    }
+
+    uint64_t compressed_offset = kArchiveHeaderSize;
+    uint64_t uncompressed_offset = 0;
+    for (size_t i = 0; i < index.entries.size(); ++i) {
+        const block_index_entry& entry = index.entries[i];
+        if (entry.compressed_offset != compressed_offset || entry.uncompressed_offset != uncompressed_offset ||
+            index.get_compressed_end(i) < compressed_offset + kBlockHeaderSize ||
+            index.get_compressed_end(i) > index.blocks_end || index.get_raw_size(i) > kMaxBlockSize ||
+            (entry.table_block != kNoTableBlock && entry.table_block > i)) {
+            throw std::runtime_error("Corrupted block index!");
+        }
+        compressed_offset = index.get_compressed_end(i);
+        uncompressed_offset += index.get_raw_size(i);
     }
+    if (compressed_offset != index.blocks_end || uncompressed_offset != index.raw_size) {
+        throw std::runtime_error("Corrupted block index!");
+    }
+
+    frequency_table_size_ += archive_size - index.blocks_end;
+    return true;
 }
 
-void binary_io::print_sizes(std::string mode) const {
+void binary_io::add_decoded_block(size_t raw_size, size_t payload_size, size_t metadata_size) {
+    not_compressed_file_size_ += raw_size;
+    compressed_file_size_ += payload_size - metadata_size;
+    frequency_table_size_ += kBlockHeaderSize + metadata_size;
+}
+
+void binary_io::print_sizes(std::string mode, std::ostream& report) const {
     if (mode == "compress") {
-        std::cout << not_compressed_file_size_ << std::endl;
-        std::cout << compressed_file_size_ << std::endl;
-        std::cout << frequency_table_size_ << std::endl;
+        report << not_compressed_file_size_ << std::endl;
+        report << compressed_file_size_ << std::endl;
+        report << frequency_table_size_ << std::endl;
     } else if (mode == "decompress") {
-        std::cout << compressed_file_size_ << std::endl;
-        std::cout << not_compressed_file_size_ << std::endl;
-        std::cout << frequency_table_size_ << std::endl;
+        report << compressed_file_size_ << std::endl;
+        report << not_compressed_file_size_ << std::endl;
+        report << frequency_table_size_ << std::endl;
     }
 }
 
@@ -129,36 +401,610 @@ size_t binary_io::get_frequency_table_size() const { return frequency_table_size
 
 size_t binary_io::get_not_compressed_file_size() const { return not_compressed_file_size_; }
 
-void huffman_compressor::compress_file(const std::string filename, const std::string output_file) const {
-    std::ofstream output(output_file, std::ios_base::binary);
+size_t compress_bound(size_t size, const compression_options& options) {
+    // no block grows past its raw size: the limited code is optimal among codes of at most
+    // max_code_length >= 8 bits, so it never loses to plain 8-bit bytes. each stream may add a partial byte
+    size_t blocks = (size + options.block_size - 1) / options.block_size;
+    size_t block_overhead = kBlockHeaderSize + kMaxBlockOverhead + kBlockIndexEntrySize;
+    size_t index_overhead = sizeof(block_type) + sizeof(uint32_t) + sizeof(uint64_t) + kTrailerSize;
+    if (options.seek_interval != 0) {
+        size_t points = size / options.seek_interval;
+        index_overhead += sizeof(uint32_t) + blocks * sizeof(uint32_t) + points * sizeof(uint64_t);
+    }
+    return kArchiveHeaderSize + size + blocks * block_overhead + index_overhead;
+}
+
+namespace {
+
+// plans a block with everything options allow but the previous block's table
+block_plan plan_with_options(const uint8_t* data, size_t size, const compression_options& options) {
+    block_plan plan = plan_block(data, size, options.max_code_length, options.streams);
+    if (options.context_order == 1) {
+        choose_context_model(plan, data, size, options.max_code_length);
+    }
+    if (options.lz_level != 0) {
+        choose_lz(plan, data, size, options.lz_level, options.max_code_length);
+    }
+    return plan;
+}
+
+}  // namespace
+
+huffman_compressor::huffman_compressor(compression_options options) : options_(options) {
+    if (options_.block_size < kMinBlockSize || options_.block_size > kMaxBlockSize) {
+        throw std::runtime_error("Block size is out of range!");
+    }
+    if (options_.max_code_length < kMinCodeLengthLimit || options_.max_code_length > kMaxCodeLengthLimit) {
+        throw std::runtime_error("Code length limit is out of range!");
+    }
+    if (options_.streams < 1 || options_.streams > kMaxStreams) {
+        throw std::runtime_error("Stream count is out of range!");
+    }
+    if (options_.context_order < 0 || options_.context_order > 1) {
+        throw std::runtime_error("Context order is out of range!");
+    }
+    if (options_.lz_level < 0 || options_.lz_level > kMaxLzLevel) {
+        throw std::runtime_error("Match finder level is out of range!");
+    }
+    if (options_.seek_interval != 0 &&
+        (options_.seek_interval < kMinSeekInterval || options_.seek_interval > kMaxBlockSize)) {
+        throw std::runtime_error("Seek interval is out of range!");
+    }
+}
+
+void huffman_compressor::compress_file(const std::string filename, const std::string output_file) {
+    input_source input(filename);
+    file_output_buffer buffer(output_file, options_.direct_output);
+    std::ostream output(&buffer);
+    compress_blocks(input, output);
+    buffer.close();
+}
+
+void huffman_compressor::compress_stream(std::istream& input, std::ostream& output) {
+    input_source source(input);
+    compress_blocks(source, output);
+}
+
+size_t huffman_compressor::compress(const uint8_t* data, size_t size, uint8_t* output, size_t capacity) {
+    input_source source(data, size);
+    output_memory_buffer buffer(output, capacity);
+    std::ostream stream(&buffer);
+    compress_blocks(source, stream);
+    if (!stream) {
+        throw std::runtime_error("Output buffer is too small!");
+    }
+    return buffer.get_size();
+}
+
+void huffman_compressor::compress(const uint8_t* data, size_t size, std::vector<uint8_t>& output) {
+    input_source source(data, size);
+    output_memory_buffer buffer(output);
+    std::ostream stream(&buffer);
+    compress_blocks(source, stream);
+}
+
+void huffman_compressor::compress(const uint8_t* data, size_t size, std::ostream& output) {
+    input_source source(data, size);
+    compress_blocks(source, output);
+}
+
+void huffman_compressor::compress_blocks(input_source& input, std::ostream& output) {
+    // input that fits one block is encoded right here into the retained block, small inputs never touch the pool
+    input_block block = input.next_block(options_.block_size);
+    input_block next = block.size != 0 ? input.next_block(options_.block_size) : input_block{};
+
+    // a single block coded with a shared table is written as a message, its index would outweigh it.
+    // seek points live in the index, archives that ask for them keep it
+    bool message = next.size == 0 && block.size != 0 && options_.shared_table != nullptr && options_.seek_interval == 0;
     binary_io bin_out;
-    huffman_tree tree;
+    if (message) {
+        bin_out.write_message_header(output);
+    } else {
+        bin_out.write_archive_header(output, options_.block_size);
+    }
 
-    tree.build_frequency_table(filename);
-    tree.build();
-    tree.build_table();
+    if (next.size == 0) {
+        if (block.size != 0) {
+            block_plan plan = plan_with_options(block.data, block.size, options_);
+            choose_table(plan, options_.streams, options_.shared_table, nullptr);
+            encode_planned(
+                block.data, block.size, plan, options_.streams, options_.shared_table, block_, options_.seek_interval
+            );
+            bin_out.write_block(output, block_);
+        }
+    } else {
+        thread_pool& pool = get_pool();
+        // a worker waiting here on its own tasks could block the pool, nested compressions are single blocks
+        if (pool.get_worker_index() >= 0) {
+            throw std::runtime_error("Multi-block input can't be compressed from the compressor's own pool!");
+        }
 
-    bin_out.write_frequency_table(output, tree);
-    bin_out.write_bits(output, filename, tree);
+        // blocks in flight are bounded so memory stays proportional to the thread count, not the input
+        const size_t max_in_flight = 2 * pool.get_thread_count();
+        std::deque<std::future<encoded_block>> in_flight;
+
+        // code lengths in effect after each block are handed down a chain of futures, all zero for none yet.
+        // a block is counted in parallel with the others and only waits for the previous one to choose its
+        // table, which that has done before encoding. tasks submitted from outside the pool are started in
+        // order, so the wait always ends. a nested compress from a worker, as archive_writer::load does,
+        // would queue them LIFO on its own deque instead: it only hands over single blocks, which are
+        // encoded inline above
+        std::promise<code_lengths> no_table;
+        no_table.set_value({});
+        std::shared_future<code_lengths> previous_table = no_table.get_future().share();
+
+        try {
+            while (block.size != 0) {
+                auto table = std::make_shared<std::promise<code_lengths>>();
+                std::shared_future<code_lengths> next_table = table->get_future().share();
+                auto task = [block = std::move(block), options = options_, previous_table, table]() {
+                    // the models weigh themselves against the block's own table, so that's built up front for
+                    // them. without models only the histogram is, the table waits to see if the previous one does
+                    bool has_models = options.context_order == 1 || options.lz_level != 0;
+                    block_plan plan;
+                    try {
+                        plan = has_models ? plan_with_options(block.data, block.size, options)
+                                          : count_block(block.data, block.size);
+                        code_lengths previous_lengths = previous_table.get();
+                        bool has_previous = previous_lengths != code_lengths{};
+                        if (!has_models) {
+                            plan_table(
+                                plan,
+                                block.size,
+                                options.max_code_length,
+                                options.streams,
+                                has_previous ? &previous_lengths : nullptr
+                            );
+                        }
+                        choose_table(
+                            plan, options.streams, options.shared_table, has_previous ? &previous_lengths : nullptr
+                        );
+                        bool own_table = plan.type == block_type::huffman || plan.type == block_type::interleaved;
+                        table->set_value(own_table ? plan.lengths : previous_lengths);
+                    } catch (...) {
+                        // the next block waits on this table, it fails with it instead of waiting forever
+                        table->set_exception(std::current_exception());
+                        throw;
+                    }
+
+                    encoded_block encoded;
+                    encode_planned(
+                        block.data,
+                        block.size,
+                        plan,
+                        options.streams,
+                        options.shared_table,
+                        encoded,
+                        options.seek_interval
+                    );
+                    return encoded;
+                };
+                in_flight.push_back(pool.submit(std::move(task)));
+                previous_table = next_table;
+                if (in_flight.size() == max_in_flight) {
+                    bin_out.write_block(output, in_flight.front().get());
+                    in_flight.pop_front();
+                }
+                block = std::move(next);
+                next = block.size != 0 ? input.next_block(options_.block_size) : input_block{};
+            }
 
-    tree.destroy(tree.get_root());
+            for (std::future<encoded_block>& encoded : in_flight) {
+                bin_out.write_block(output, encoded.get());
+            }
+        } catch (...) {
+            // the tasks read blocks the input owns, every one has to finish before the input may go
+            for (std::future<encoded_block>& encoded : in_flight) {
+                if (encoded.valid()) {
+                    encoded.wait();
+                }
+            }
+            throw;
+        }
+    }
+    if (!message) {
+        bin_out.write_block_index(output, options_.seek_interval);
+    }
+    output.flush();
+
+    if (options_.size_report != nullptr) {
+        bin_out.print_sizes("compress", *options_.size_report);
+    }
+}
 
-    bin_out.print_sizes("compress");
+thread_pool& huffman_compressor::get_pool() {
+    if (pool_ == nullptr) {
+        pool_ = std::make_unique<thread_pool>(options_.threads);
+    }
+    return *pool_;
 }
 
-void huffman_decompressor::decompress_file(const std::string input_file, const std::string output_file) const {
+huffman_decompressor::huffman_decompressor(decompression_options options) : options_(options) {}
+
+void huffman_decompressor::decompress_file(const std::string input_file, const std::string output_file) {
     std::ifstream input(input_file, std::ios_base::binary);
+    file_output_buffer buffer(output_file, options_.direct_output);
+    std::ostream output(&buffer);
+    decompress_archive(input, output);
+    buffer.close();
+}
+
+size_t huffman_decompressor::decompress(const uint8_t* data, size_t size, uint8_t* output, size_t capacity) {
+    input_memory_buffer input_buffer(data, size);
+    output_memory_buffer output_buffer(output, capacity);
+    std::istream input(&input_buffer);
+    std::ostream stream(&output_buffer);
+    decompress_archive(input, stream);
+    if (!stream) {
+        throw std::runtime_error("Output buffer is too small!");
+    }
+    return output_buffer.get_size();
+}
+
+void huffman_decompressor::decompress(const uint8_t* data, size_t size, std::vector<uint8_t>& output) {
+    input_memory_buffer input_buffer(data, size);
+    output_memory_buffer output_buffer(output);
+    std::istream input(&input_buffer);
+    std::ostream stream(&output_buffer);
+    decompress_archive(input, stream);
+}
+
+void huffman_decompressor::decompress(const uint8_t* data, size_t size, std::ostream& output) {
+    input_memory_buffer input_buffer(data, size);
+    std::istream input(&input_buffer);
+    decompress_archive(input, output);
+}
+
+void huffman_decompressor::decompress_range(
+    const std::string& input_file,
+    uint64_t offset,
+    uint64_t length,
+    std::ostream& output
+) {
+    std::ifstream input(input_file, std::ios_base::binary);
+    if (!input) {
+        throw std::runtime_error("Input file can't be opened!");
+    }
+    decompress_range(input, offset, length, output);
+}
+
+void huffman_decompressor::decompress_range(
+    const uint8_t* data,
+    size_t size,
+    uint64_t offset,
+    uint64_t length,
+    std::vector<uint8_t>& output
+) {
+    input_memory_buffer input_buffer(data, size);
+    output_memory_buffer output_buffer(output);
+    std::istream input(&input_buffer);
+    std::ostream stream(&output_buffer);
+    decompress_range(input, offset, length, stream);
+}
+
+void huffman_decompressor::decompress_range(
+    std::istream& input,
+    uint64_t offset,
+    uint64_t length,
+    std::ostream& output
+) {
+    binary_io bin_in;
+    block_index index;
+    archive_kind kind = bin_in.read_magic(input);
+    if (kind == archive_kind::original) {
+        throw std::runtime_error("Only block archives can be read by range!");
+    }
+    if (kind == archive_kind::message) {
+        decompress_message(input, bin_in, offset, length, output);
+    } else {
+        bin_in.read_archive_header(input);
+        if (!bin_in.read_block_index(input, index)) {
+            throw std::runtime_error("Archive has no block index!");
+        }
+        if (offset > index.raw_size) {
+            throw std::runtime_error("Range starts past the end of the file!");
+        }
+
+        decompress_indexed(input, bin_in, index, offset, offset + std::min(length, index.raw_size - offset), output);
+    }
+    output.flush();
+
+    if (options_.size_report != nullptr) {
+        bin_in.print_sizes("decompress", *options_.size_report);
+    }
+}
+
+void huffman_decompressor::decompress_archive(std::istream& input, std::ostream& output) {
     binary_io bin_in;
     huffman_tree tree;
 
-    bin_in.read_frequency_table(input, tree);
-    tree.build();
-    tree.build_table();
-    bin_in.read_bits(input, tree, output_file);
+    archive_kind kind = bin_in.read_magic(input);
+    if (kind == archive_kind::message) {
+        decompress_message(input, bin_in, 0, UINT64_MAX, output);
+    } else if (kind == archive_kind::blocks) {
+        bin_in.read_archive_header(input);
+
+        block_index index;
+        if (bin_in.read_block_index(input, index)) {
+            decompress_indexed(input, bin_in, index, 0, index.raw_size, output);
+        } else {
+            decompress_blocks(input, bin_in, output);
+        }
+    } else {
+        bin_in.read_frequency_table(input, tree);
+        tree.build();
+        tree.build_table();
+        bin_in.read_bits(input, tree, output);
+
+        tree.destroy(tree.get_root());
+    }
+    output.flush();
+
+    if (options_.size_report != nullptr) {
+        bin_in.print_sizes("decompress", *options_.size_report);
+    }
+}
+
+void huffman_decompressor::decompress_stream(std::istream& input, std::ostream& output) {
+    binary_io bin_in;
+    archive_kind kind = bin_in.read_magic(input);
+    if (kind == archive_kind::original) {
+        throw std::runtime_error("Only block archives can be decompressed from a stream!");
+    }
+
+    if (kind == archive_kind::message) {
+        decompress_message(input, bin_in, 0, UINT64_MAX, output);
+    } else {
+        bin_in.read_archive_header(input);
+        decompress_blocks(input, bin_in, output);
+    }
+    output.flush();
+
+    if (options_.size_report != nullptr) {
+        bin_in.print_sizes("decompress", *options_.size_report);
+    }
+}
+
+// decodes block records one after another up to the end record
+void huffman_decompressor::decompress_blocks(std::istream& input, binary_io& bin_in, std::ostream& output) {
+    block_type type;
+    uint32_t raw_size;
+    code_lengths previous_lengths;
+    bool has_previous = false;
+
+    while (bin_in.read_block(input, type, raw_size, compressed_)) {
+        decoded_.resize(raw_size);
+        size_t metadata_size = decode_block(
+            type,
+            compressed_.data(),
+            compressed_.size(),
+            decoded_.data(),
+            raw_size,
+            table_,
+            options_.shared_table,
+            has_previous ? &previous_lengths : nullptr
+        );
+        has_previous |= read_code_lengths(type, compressed_.data(), compressed_.size(), previous_lengths);
+        output.write(decoded_.data(), raw_size);
+        bin_in.add_decoded_block(raw_size, compressed_.size(), metadata_size);
+    }
+}
+
+void huffman_decompressor::decompress_message(
+    std::istream& input,
+    binary_io& bin_in,
+    uint64_t offset,
+    uint64_t length,
+    std::ostream& output
+) {
+    block_type type;
+    uint32_t raw_size;
+    if (!bin_in.read_block(input, type, raw_size, compressed_)) {
+        throw std::runtime_error("Message has no block!");
+    }
+    if (offset > raw_size) {
+        throw std::runtime_error("Range starts past the end of the file!");
+    }
+
+    // a message is a single block, there's no earlier table to repeat
+    decoded_.resize(raw_size);
+    size_t metadata_size = decode_block(
+        type,
+        compressed_.data(),
+        compressed_.size(),
+        decoded_.data(),
+        raw_size,
+        table_,
+        options_.shared_table,
+        nullptr
+    );
+    output.write(decoded_.data() + offset, std::min<uint64_t>(length, raw_size - offset));
+    bin_in.add_decoded_block(raw_size, compressed_.size(), metadata_size);
+}
+
+// reads a window of consecutive blocks at once, then every block is decoded on the pool
+// into its own disjoint region of the window's output buffer.
+// only the blocks overlapping [begin, end) of the original file are read, and only that part is written
+void huffman_decompressor::decompress_indexed(
+    std::istream& input,
+    binary_io& bin_in,
+    const block_index& index,
+    uint64_t begin,
+    uint64_t end,
+    std::ostream& output
+) {
+    if (begin >= end) {
+        return;
+    }
+    auto block_of = [&](uint64_t position) {
+        auto after = std::upper_bound(
+            index.entries.begin(),
+            index.entries.end(),
+            position,
+            [](uint64_t value, const block_index_entry& entry) { return value < entry.uncompressed_offset; }
+        );
+        return static_cast<size_t>(after - index.entries.begin()) - 1;
+    };
+    size_t first_block = block_of(begin);
+    size_t end_block = block_of(end - 1) + 1;
+
+    // an archive of one block is decoded right here, small archives never touch the pool
+    const size_t window_blocks = end_block - first_block <= 1 ? 1 : 2 * get_pool().get_thread_count();
+
+    // code lengths a repeat block refers to, collected in archive order before a window is decoded
+    code_lengths current_lengths;
+    bool has_current = find_previous_table(input, index, first_block, current_lengths);
+    std::vector<code_lengths> previous_lengths(window_blocks);
+    std::vector<bool> has_previous(window_blocks);
+
+    for (size_t first = first_block; first < end_block; first += window_blocks) {
+        size_t last = std::min(first + window_blocks, end_block);
+        uint64_t compressed_begin = index.entries[first].compressed_offset;
+        uint64_t uncompressed_begin = index.entries[first].uncompressed_offset;
+
+        uint64_t uncompressed_end = index.entries[last - 1].uncompressed_offset + index.get_raw_size(last - 1);
+        // the first and last window may hold bytes outside the range
+        auto write_window = [&](uint64_t window_begin, uint64_t window_end) {
+            uint64_t from = std::max(begin, window_begin), to = std::min(end, window_end);
+            output.write(decoded_.data() + (from - window_begin), to - from);
+        };
+        compressed_.resize(index.get_compressed_end(last - 1) - compressed_begin);
+        decoded_.resize(uncompressed_end - uncompressed_begin);
+        input.seekg(compressed_begin);
+        if (!input.read(reinterpret_cast<char*>(compressed_.data()), compressed_.size())) {
+            throw std::runtime_error("Archive is truncated!");
+        }
+
+        auto record_of = [&](size_t block) {
+            return compressed_.data() + (index.entries[block].compressed_offset - compressed_begin);
+        };
+        for (size_t block = first; block < last; ++block) {
+            size_t record_size = index.get_compressed_end(block) - index.entries[block].compressed_offset;
+            block_header header = parse_block_header(record_of(block), record_size);
+            previous_lengths[block - first] = current_lengths;
+            has_previous[block - first] = has_current;
+            const uint8_t* payload = record_of(block) + kBlockHeaderSize;
+            has_current |= read_code_lengths(header.type, payload, header.payload_size, current_lengths);
+        }
 
-    tree.destroy(tree.get_root());
+        auto decode_record = [&](size_t block, decode_table& table) {
+            const uint8_t* record = record_of(block);
+            size_t record_size = index.get_compressed_end(block) - index.entries[block].compressed_offset;
+            block_header header = parse_block_header(record, record_size);
+            if (header.raw_size != index.get_raw_size(block) || kBlockHeaderSize + header.payload_size != record_size) {
+                throw std::runtime_error("Block record does not match the block index!");
+            }
+
+            char* region = decoded_.data() + (index.entries[block].uncompressed_offset - uncompressed_begin);
+            // a block the range only partly covers is decoded from the seek point before the range to its end
+            uint64_t block_begin = index.entries[block].uncompressed_offset;
+            size_t from = std::max(begin, block_begin) - block_begin;
+            size_t to = std::min(end, block_begin + header.raw_size) - block_begin;
+            if ((from != 0 || to != header.raw_size) && is_seekable(header.type)) {
+                static const std::vector<uint64_t> no_points;
+                size_t metadata_size = decode_block_range(
+                    header.type,
+                    record + kBlockHeaderSize,
+                    header.payload_size,
+                    region,
+                    header.raw_size,
+                    from,
+                    to,
+                    table,
+                    options_.shared_table,
+                    has_previous[block - first] ? &previous_lengths[block - first] : nullptr,
+                    index.seek_interval,
+                    index.seek_interval != 0 ? index.seek_points[block] : no_points
+                );
+                return std::make_pair(size_t(header.payload_size), metadata_size);
+            }
+            size_t metadata_size = decode_block(
+                header.type,
+                record + kBlockHeaderSize,
+                header.payload_size,
+                region,
+                header.raw_size,
+                table,
+                options_.shared_table,
+                has_previous[block - first] ? &previous_lengths[block - first] : nullptr
+            );
+            return std::make_pair(size_t(header.payload_size), metadata_size);
+        };
+
+        if (last - first == 1) {
+            auto [payload_size, metadata_size] = decode_record(first, table_);
+            bin_in.add_decoded_block(index.get_raw_size(first), payload_size, metadata_size);
+            write_window(uncompressed_begin, uncompressed_end);
+            continue;
+        }
 
-    bin_in.print_sizes("decompress");
+        std::vector<std::future<std::pair<size_t, size_t>>> results;
+        for (size_t block = first; block < last; ++block) {
+            results.push_back(get_pool().submit([&, block]() {
+                decode_table table;
+                return decode_record(block, table);
+            }));
+        }
+
+        // every task has to finish before an exception may release the buffers they write to
+        for (auto& result : results) {
+            result.wait();
+        }
+        for (size_t block = first; block < last; ++block) {
+            auto [payload_size, metadata_size] = results[block - first].get();
+            bin_in.add_decoded_block(index.get_raw_size(block), payload_size, metadata_size);
+        }
+        write_window(uncompressed_begin, uncompressed_end);
+    }
+}
+
+// the nearest huffman or interleaved block before the given one: the index names it, older indexes
+// without table blocks are scanned backwards one block header at a time
+bool huffman_decompressor::find_previous_table(
+    std::istream& input,
+    const block_index& index,
+    size_t block,
+    code_lengths& lengths
+) {
+    std::array<uint8_t, kBlockHeaderSize + kMaxPackedCodeLengthsSize> record;
+    // the code lengths header opens the payload, nothing past it is needed
+    auto read_prefix = [&](size_t table_block) {
+        uint64_t record_size = index.get_compressed_end(table_block) - index.entries[table_block].compressed_offset;
+        size_t prefix_size = std::min<uint64_t>(record_size, record.size());
+        input.seekg(index.entries[table_block].compressed_offset);
+        if (!input.read(reinterpret_cast<char*>(record.data()), prefix_size)) {
+            throw std::runtime_error("Archive is truncated!");
+        }
+        return prefix_size;
+    };
+
+    if (index.has_table_blocks) {
+        if (block == 0 || index.entries[block - 1].table_block == kNoTableBlock) {
+            return false;
+        }
+        size_t prefix_size = read_prefix(index.entries[block - 1].table_block);
+        block_type type = static_cast<block_type>(record[0]);
+        if (!read_code_lengths(type, record.data() + kBlockHeaderSize, prefix_size - kBlockHeaderSize, lengths)) {
+            throw std::runtime_error("Corrupted block index!");
+        }
+        return true;
+    }
+
+    while (block-- > 0) {
+        size_t prefix_size = read_prefix(block);
+        block_type type = static_cast<block_type>(record[0]);
+        if (type == block_type::huffman || type == block_type::interleaved) {
+            return read_code_lengths(type, record.data() + kBlockHeaderSize, prefix_size - kBlockHeaderSize, lengths);
+        }
+    }
+    return false;
+}
+
+thread_pool& huffman_decompressor::get_pool() {
+    if (pool_ == nullptr) {
+        pool_ = std::make_unique<thread_pool>(options_.threads);
+    }
+    return *pool_;
 }
 
 }  // namespace huffman
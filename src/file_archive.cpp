@@ -0,0 +1,351 @@
+#include "file_archive.h"
+
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <streambuf>
+#include "checksum.h"
+
+namespace huffman {
+
+namespace {
+
+// a batch holds about a block of small files, but no more than this many
+constexpr size_t kMaxBatchFiles = 64;
+
+constexpr size_t kDirectoryTrailerSize = sizeof(uint64_t) + kDirectoryMagic.size();
+
+template <typename T>
+void write_value(std::ostream& output, T value) {
+    output.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void write_name(std::ostream& output, const std::string& name) {
+    write_value(output, static_cast<uint16_t>(name.size()));
+    output.write(name.data(), name.size());
+}
+
+// bounds-checked reads from the mapped archive
+class byte_cursor {
+public:
+    byte_cursor(const uint8_t* data, size_t size, size_t position) : data_(data), size_(size), position_(position) {}
+
+    template <typename T>
+    T read() {
+        T value;
+        std::memcpy(&value, take(sizeof(value)), sizeof(value));
+        return value;
+    }
+
+    std::string read_name() {
+        uint16_t size = read<uint16_t>();
+        return std::string(reinterpret_cast<const char*>(take(size)), size);
+    }
+
+    [[nodiscard]] size_t get_position() const { return position_; }
+
+private:
+    const uint8_t* take(size_t size) {
+        if (position_ > size_ || size > size_ - position_) {
+            throw std::runtime_error("Corrupted multi-file archive!");
+        }
+        position_ += size;
+        return data_ + position_ - size;
+    }
+
+    const uint8_t* data_;
+    size_t size_;
+    size_t position_;
+};
+
+// passes everything on to target, counting it and taking its crc on the way
+class checksum_buffer : public std::streambuf {
+public:
+    explicit checksum_buffer(std::streambuf* target) : target_(target), size_(0), checksum_(0) {}
+
+    [[nodiscard]] uint64_t get_size() const { return size_; }
+    [[nodiscard]] uint32_t get_checksum() const { return checksum_; }
+
+protected:
+    int_type overflow(int_type symbol) override {
+        if (traits_type::eq_int_type(symbol, traits_type::eof())) {
+            return traits_type::not_eof(symbol);
+        }
+        char byte = traits_type::to_char_type(symbol);
+        return xsputn(&byte, 1) == 1 ? symbol : traits_type::eof();
+    }
+
+    std::streamsize xsputn(const char* data, std::streamsize size) override {
+        checksum_ = crc32(reinterpret_cast<const uint8_t*>(data), size, checksum_);
+        size_ += size;
+        return target_->sputn(data, size);
+    }
+
+    int sync() override { return target_->pubsync(); }
+
+private:
+    std::streambuf* target_;
+    uint64_t size_;
+    uint32_t checksum_;
+};
+
+// member sizes are in the central directory, they aren't reported one by one
+template <typename Options>
+Options without_report(Options options) {
+    options.size_report = nullptr;
+    return options;
+}
+
+}  // namespace
+
+archive_writer::archive_writer(const std::string& filename, compression_options options)
+    : options_(without_report(options)),
+      output_buffer_(filename, options.direct_output),
+      output_(&output_buffer_),
+      batch_size_(0),
+      finished_(false),
+      compressor_(options_) {
+    output_.write(kFileArchiveMagic.data(), kFileArchiveMagic.size());
+}
+
+archive_writer::~archive_writer() {
+    // the tasks use this writer's compressors, so none may outlive it
+    for (pending_batch& batch : pending_) {
+        try {
+            for (std::future<loaded_member>& member : batch.members.get()) {
+                member.wait();
+            }
+        } catch (...) {
+        }
+    }
+}
+
+void archive_writer::add_file(const std::string& filename, const std::string& name) {
+    if (finished_) {
+        throw std::runtime_error("Archive is already finished!");
+    }
+    if (name.empty() || name.size() > UINT16_MAX) {
+        throw std::runtime_error("Incorrect member name!");
+    }
+
+    // sizes only decide the batching, a file that can't be measured is read whole by its task
+    std::error_code error;
+    size_t size = std::filesystem::file_size(filename, error);
+    if (error) {
+        size = 0;
+    }
+    if (size > options_.block_size) {
+        submit_batch();
+    }
+    batch_.emplace_back(filename, name);
+    batch_size_ += size;
+    if (batch_size_ >= options_.block_size || batch_.size() == kMaxBatchFiles) {
+        submit_batch();
+    }
+}
+
+void archive_writer::add(const std::string& name, const uint8_t* data, size_t size) {
+    if (finished_) {
+        throw std::runtime_error("Archive is already finished!");
+    }
+    if (name.empty() || name.size() > UINT16_MAX) {
+        throw std::runtime_error("Incorrect member name!");
+    }
+
+    submit_batch();
+    drain(0);
+    write_member(name, data, size, crc32(data, size), nullptr);
+}
+
+void archive_writer::finish() {
+    if (finished_) {
+        return;
+    }
+    submit_batch();
+    drain(0);
+
+    uint64_t directory_offset = output_.tellp();
+    write_value(output_, static_cast<uint32_t>(members_.size()));
+    for (const archive_member& member : members_) {
+        write_name(output_, member.name);
+        write_value(output_, member.offset);
+        write_value(output_, member.compressed_size);
+        write_value(output_, member.original_size);
+        write_value(output_, member.checksum);
+    }
+    write_value(output_, directory_offset);
+    output_.write(kDirectoryMagic.data(), kDirectoryMagic.size());
+    output_.flush();
+    if (!output_) {
+        throw std::runtime_error("Archive can't be written!");
+    }
+    output_buffer_.close();
+    finished_ = true;
+}
+
+void archive_writer::submit_batch() {
+    if (batch_.empty()) {
+        return;
+    }
+
+    thread_pool& pool = compressor_.get_pool();
+    if (worker_compressors_.empty()) {
+        compression_options options = options_;
+        options.threads = 1;
+        for (unsigned i = 0; i < pool.get_thread_count(); ++i) {
+            worker_compressors_.push_back(std::make_unique<huffman_compressor>(options));
+        }
+    }
+
+    pending_batch batch;
+    for (const auto& file : batch_) {
+        batch.names.push_back(file.second);
+    }
+    batch.members = pool.submit([this, &pool, files = std::move(batch_)]() {
+        std::vector<std::future<loaded_member>> members;
+        std::packaged_task<loaded_member()> first([this, &files]() { return load(files[0].first); });
+        members.push_back(first.get_future());
+        for (size_t i = 1; i < files.size(); ++i) {
+            members.push_back(pool.submit([this, filename = files[i].first]() { return load(filename); }));
+        }
+        first();
+        return members;
+    });
+    pending_.push_back(std::move(batch));
+    batch_.clear();
+    batch_size_ = 0;
+
+    drain(2 * pool.get_thread_count());
+}
+
+void archive_writer::drain(size_t max_pending) {
+    while (pending_.size() > max_pending) {
+        pending_batch batch = std::move(pending_.front());
+        pending_.pop_front();
+
+        std::vector<std::future<loaded_member>> members = batch.members.get();
+        for (size_t i = 0; i < members.size(); ++i) {
+            loaded_member member = members[i].get();
+            const uint8_t* data = member.file != nullptr ? member.file->get_data() : member.data.data();
+            write_member(
+                batch.names[i], data, member.size, member.checksum, member.compressed ? &member.archive : nullptr
+            );
+        }
+    }
+}
+
+loaded_member archive_writer::load(const std::string& filename) {
+    loaded_member member;
+    member.file = std::make_unique<mapped_file>(filename);
+    if (!member.file->is_mapped()) {
+        // pipes and devices are read whole
+        member.data = read_file(filename);
+        member.file.reset();
+    }
+    const uint8_t* data = member.file != nullptr ? member.file->get_data() : member.data.data();
+    member.size = member.file != nullptr ? member.file->get_size() : member.data.size();
+    member.checksum = crc32(data, member.size);
+
+    // larger files are left to the writer, which splits them into blocks on the pool
+    member.compressed = member.size <= options_.block_size;
+    if (member.compressed) {
+        int worker = compressor_.get_pool().get_worker_index();
+        worker_compressors_[worker]->compress(data, member.size, member.archive);
+        member.file.reset();
+        member.data = std::vector<uint8_t>();
+    }
+    return member;
+}
+
+void archive_writer::write_member(
+    const std::string& name,
+    const uint8_t* data,
+    uint64_t size,
+    uint32_t checksum,
+    const std::vector<uint8_t>* archive
+) {
+    archive_member member{name, static_cast<uint64_t>(output_.tellp()), 0, size, checksum};
+    write_name(output_, name);
+    write_value(output_, member.original_size);
+    write_value(output_, member.checksum);
+
+    if (archive != nullptr) {
+        output_.write(reinterpret_cast<const char*>(archive->data()), archive->size());
+        member.compressed_size = archive->size();
+    } else {
+        uint64_t start = output_.tellp();
+        compressor_.compress(data, size, output_);
+        member.compressed_size = static_cast<uint64_t>(output_.tellp()) - start;
+    }
+    if (!output_) {
+        throw std::runtime_error("Archive can't be written!");
+    }
+    members_.push_back(member);
+}
+
+const std::vector<archive_member>& archive_writer::get_members() const { return members_; }
+
+archive_reader::archive_reader(const std::string& filename, decompression_options options)
+    : archive_(filename), decompressor_(without_report(options)) {
+    const uint8_t* data = archive_.get_data();
+    size_t size = archive_.get_size();
+    if (!archive_.is_mapped() || size < kFileArchiveMagic.size() + sizeof(uint32_t) + kDirectoryTrailerSize ||
+        std::memcmp(data, kFileArchiveMagic.data(), kFileArchiveMagic.size()) != 0 ||
+        std::memcmp(data + size - kDirectoryMagic.size(), kDirectoryMagic.data(), kDirectoryMagic.size()) != 0) {
+        throw std::runtime_error("Not a multi-file archive!");
+    }
+
+    uint64_t directory_offset;
+    std::memcpy(&directory_offset, data + size - kDirectoryTrailerSize, sizeof(directory_offset));
+    if (directory_offset < kFileArchiveMagic.size() || directory_offset > size - kDirectoryTrailerSize) {
+        throw std::runtime_error("Corrupted multi-file archive!");
+    }
+
+    byte_cursor directory(data, size - kDirectoryTrailerSize, directory_offset);
+    uint32_t member_count = directory.read<uint32_t>();
+    for (uint32_t i = 0; i < member_count; ++i) {
+        archive_member member;
+        member.name = directory.read_name();
+        member.offset = directory.read<uint64_t>();
+        member.compressed_size = directory.read<uint64_t>();
+        member.original_size = directory.read<uint64_t>();
+        member.checksum = directory.read<uint32_t>();
+        if (member.offset > directory_offset || member.compressed_size > directory_offset - member.offset) {
+            throw std::runtime_error("Corrupted multi-file archive!");
+        }
+        members_.push_back(std::move(member));
+    }
+}
+
+const std::vector<archive_member>& archive_reader::get_members() const { return members_; }
+
+const archive_member* archive_reader::find(const std::string& name) const {
+    for (const archive_member& member : members_) {
+        if (member.name == name) {
+            return &member;
+        }
+    }
+    return nullptr;
+}
+
+void archive_reader::extract(const archive_member& member, std::ostream& output) {
+    // the member header has to agree with the directory
+    byte_cursor header(archive_.get_data(), archive_.get_size(), member.offset);
+    if (header.read_name() != member.name || header.read<uint64_t>() != member.original_size ||
+        header.read<uint32_t>() != member.checksum ||
+        member.compressed_size > archive_.get_size() - header.get_position()) {
+        throw std::runtime_error("Corrupted multi-file archive!");
+    }
+
+    checksum_buffer buffer(output.rdbuf());
+    std::ostream stream(&buffer);
+    decompressor_.decompress(archive_.get_data() + header.get_position(), member.compressed_size, stream);
+    if (!stream) {
+        throw std::runtime_error("Member can't be written!");
+    }
+    if (buffer.get_size() != member.original_size || buffer.get_checksum() != member.checksum) {
+        throw std::runtime_error("Member doesn't match its checksum!");
+    }
+}
+
+}  // namespace huffman
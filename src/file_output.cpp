@@ -0,0 +1,145 @@
+#include "file_output.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+namespace huffman {
+
+file_output_buffer::file_output_buffer(const std::string& filename, bool direct, size_t capacity)
+    : descriptor_(-1), direct_(false), failed_(false), file_offset_(0) {
+    capacity_ = std::max(kAlignment, (capacity + kAlignment - 1) / kAlignment * kAlignment);
+    buffer_.reset(static_cast<char*>(std::aligned_alloc(kAlignment, capacity_)));
+    if (buffer_ == nullptr) {
+        throw std::bad_alloc();
+    }
+
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+    if (direct) {
+        // file systems without direct I/O refuse the flag, they get a plain descriptor instead
+        descriptor_ = open(filename.c_str(), flags | O_DIRECT, 0644);
+        direct_ = descriptor_ >= 0;
+    }
+#endif
+    if (descriptor_ < 0) {
+        descriptor_ = open(filename.c_str(), flags, 0644);
+    }
+    if (descriptor_ < 0) {
+        throw std::runtime_error("Output file can't be created!");
+    }
+    setp(buffer_.get(), buffer_.get() + capacity_);
+}
+
+file_output_buffer::~file_output_buffer() {
+    try {
+        close();
+    } catch (const std::runtime_error&) {
+    }
+}
+
+void file_output_buffer::close() {
+    if (descriptor_ < 0) {
+        return;
+    }
+
+    // the tail is rarely a whole page, direct output is turned off for it
+#ifdef O_DIRECT
+    if (direct_ && pptr() != pbase()) {
+        fcntl(descriptor_, F_SETFL, fcntl(descriptor_, F_GETFL) & ~O_DIRECT);
+        direct_ = false;
+    }
+#endif
+    flush_buffer(false);
+    if (::close(descriptor_) != 0) {
+        failed_ = true;
+    }
+    descriptor_ = -1;
+    if (failed_) {
+        throw std::runtime_error("Output file can't be written!");
+    }
+}
+
+bool file_output_buffer::is_direct() const { return direct_; }
+
+std::streambuf::int_type file_output_buffer::overflow(int_type symbol) {
+    if (!flush_buffer(true)) {
+        return traits_type::eof();
+    }
+    if (!traits_type::eq_int_type(symbol, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(symbol);
+        pbump(1);
+    }
+    return traits_type::not_eof(symbol);
+}
+
+std::streamsize file_output_buffer::xsputn(const char* data, std::streamsize size) {
+    std::streamsize written = 0;
+    // a plain descriptor takes large writes straight from the caller's memory, direct output needs
+    // them aligned, so they go through the buffer
+    if (!direct_ && static_cast<size_t>(size) >= capacity_) {
+        if (!flush_buffer(false) || !write_at(data, size)) {
+            return 0;
+        }
+        return size;
+    }
+    while (written < size) {
+        if (pptr() == epptr() && !flush_buffer(true)) {
+            return written;
+        }
+        size_t chunk = std::min<size_t>(size - written, epptr() - pptr());
+        std::memcpy(pptr(), data + written, chunk);
+        pbump(static_cast<int>(chunk));
+        written += chunk;
+    }
+    return written;
+}
+
+int file_output_buffer::sync() { return flush_buffer(direct_) ? 0 : -1; }
+
+std::streambuf::pos_type file_output_buffer::seekoff(
+    off_type offset,
+    std::ios_base::seekdir direction,
+    std::ios_base::openmode which
+) {
+    if (offset != 0 || direction != std::ios_base::cur || !(which & std::ios_base::out)) {
+        return pos_type(off_type(-1));
+    }
+    return pos_type(static_cast<off_type>(file_offset_ + (pptr() - pbase())));
+}
+
+bool file_output_buffer::flush_buffer(bool whole_pages) {
+    size_t pending = pptr() - pbase();
+    size_t size = whole_pages && direct_ ? pending / kAlignment * kAlignment : pending;
+    if (size != 0 && !write_at(pbase(), size)) {
+        return false;
+    }
+
+    // a partial page left by direct output moves to the front of the buffer
+    std::memmove(buffer_.get(), pbase() + size, pending - size);
+    setp(buffer_.get(), buffer_.get() + capacity_);
+    pbump(static_cast<int>(pending - size));
+    return true;
+}
+
+bool file_output_buffer::write_at(const char* data, size_t size) {
+    while (size != 0 && !failed_) {
+        ssize_t written = pwrite(descriptor_, data, size, file_offset_);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            failed_ = true;
+            break;
+        }
+        data += written;
+        size -= written;
+        file_offset_ += written;
+    }
+    return !failed_;
+}
+
+}  // namespace huffman
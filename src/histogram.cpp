@@ -0,0 +1,76 @@
+#include "histogram.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace huffman {
+
+namespace {
+
+// a single table serializes on runs of the same byte, every increment waits for the previous store.
+// four tables take consecutive bytes, so repeated bytes land in different counters
+constexpr int kTables = 4;
+
+// keeps the 32-bit split counters from overflowing
+constexpr size_t kMaxChunk = size_t(1) << 31;
+
+}  // namespace
+
+histogram::histogram() { clear(); }
+
+void histogram::add(const uint8_t* data, size_t size) {
+    total_ += size;
+
+    while (size != 0) {
+        size_t chunk = std::min(size, kMaxChunk);
+        uint32_t tables[kTables][256] = {};
+        const uint8_t* end = data + chunk;
+
+        for (; end - data >= 8; data += 8) {
+            uint64_t word;
+            std::memcpy(&word, data, sizeof(word));
+            tables[0][word & 0xff] += 1;
+            tables[1][(word >> 8) & 0xff] += 1;
+            tables[2][(word >> 16) & 0xff] += 1;
+            tables[3][(word >> 24) & 0xff] += 1;
+            tables[0][(word >> 32) & 0xff] += 1;
+            tables[1][(word >> 40) & 0xff] += 1;
+            tables[2][(word >> 48) & 0xff] += 1;
+            tables[3][word >> 56] += 1;
+        }
+        for (; data != end; ++data) {
+            tables[0][*data] += 1;
+        }
+
+        for (int symbol = 0; symbol < 256; ++symbol) {
+            counts_[symbol] += tables[0][symbol] + tables[1][symbol] + tables[2][symbol] + tables[3][symbol];
+        }
+        size -= chunk;
+    }
+}
+
+void histogram::clear() {
+    counts_.fill(0);
+    total_ = 0;
+}
+
+const std::array<uint64_t, 256>& histogram::get_counts() const { return counts_; }
+
+uint64_t histogram::get_total() const { return total_; }
+
+int histogram::get_alphabet_power() const {
+    return std::count_if(counts_.begin(), counts_.end(), [](uint64_t count) { return count != 0; });
+}
+
+double histogram::get_entropy_bits() const {
+    double bits = 0;
+    for (uint64_t count : counts_) {
+        if (count != 0) {
+            bits += count * std::log2(double(total_) / count);
+        }
+    }
+    return bits;
+}
+
+}  // namespace huffman
@@ -1,71 +1,138 @@
 #include "huffman_tree.h"
+#include <algorithm>
 #include <fstream>
 #include <memory>
+#include <new>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "input_source.h"
 
 namespace huffman {
 
-huffman_tree_node::huffman_tree_node(char symbol, int frequency) {
-    symbol_ = symbol;
-    frequency_ = frequency;
-    left_child_ = nullptr;
-    right_child_ = nullptr;
-}
+huffman_tree_node::huffman_tree_node() : frequency_(0), left_offset_(0), right_offset_(0), symbol_(0) {}
+
+huffman_tree_node::huffman_tree_node(char symbol, uint64_t frequency)
+    : frequency_(frequency), left_offset_(0), right_offset_(0), symbol_(symbol) {}
+
+// both children must be in the same pool as the node, within 16-bit reach
+huffman_tree_node::huffman_tree_node(huffman_tree_node* left_child, huffman_tree_node* right_child)
+    : frequency_(left_child->frequency_ + right_child->frequency_),
+      left_offset_(static_cast<int16_t>(left_child - this)),
+      right_offset_(static_cast<int16_t>(right_child - this)),
+      symbol_(0) {}
 
-huffman_tree_node::huffman_tree_node(huffman_tree_node* left_child, huffman_tree_node* right_child) {
-    frequency_ = left_child->frequency_ + right_child->frequency_;
-    left_child_ = left_child;
-    right_child_ = right_child;
+uint64_t huffman_tree_node::get_frequency() const { return frequency_; }
+
+huffman_tree::huffman_tree() : node_count_(0), root_(nullptr), alphabet_power_(0), number_of_chars_(0) {
+    chars_frequency_.fill(0);
 }
 
-int huffman_tree_node::get_frequency() const { return frequency_; }
+// nodes are constructed in place, their child offsets are relative to the slot they end up in
+template <typename... Args>
+huffman_tree_node* huffman_tree::make_node(Args... args) {
+    return new (&nodes_[node_count_++]) huffman_tree_node(args...);
+}
 
 int huffman_tree::get_alphabet_power() const { return alphabet_power_; }
 
-std::map<char, int> huffman_tree::get_chars_frequency() const { return chars_frequency_; }
+std::map<char, int> huffman_tree::get_chars_frequency() const {
+    std::map<char, int> frequency;
+    for (int symbol = 0; symbol < 256; ++symbol) {
+        if (chars_frequency_[symbol] != 0) {
+            frequency.insert({static_cast<char>(symbol), chars_frequency_[symbol]});
+        }
+    }
+    return frequency;
+}
 
 int huffman_tree::get_number_of_chars() const { return number_of_chars_; }
 
 // builds char's frequency table
 void huffman_tree::build_frequency_table(const std::string& filename) {
-    char buf;
-    number_of_chars_ = 0;
-    std::ifstream in(filename);
-
-    while (in.get(buf)) {
-        if (chars_frequency_.find(buf) == chars_frequency_.end()) {
-            chars_frequency_.insert({buf, 0});
-        }
-        chars_frequency_[buf] += 1;
-        number_of_chars_ += 1;
+    mapped_file source(filename);
+    if (!source.is_mapped()) {
+        // pipes and devices are read whole
+        std::vector<uint8_t> data = read_file(filename);
+        build_frequency_table(data.data(), data.size());
+        return;
     }
+    build_frequency_table(source.get_data(), source.get_size());
+}
 
-    alphabet_power_ = chars_frequency_.size();
+void huffman_tree::build_frequency_table(const uint8_t* data, size_t size) {
+    histogram counts;
+    counts.add(data, size);
+    build_frequency_table(counts);
 }
 
+void huffman_tree::build_frequency_table(const histogram& counts) {
+    chars_frequency_ = counts.get_counts();
+    number_of_chars_ = counts.get_total();
+    alphabet_power_ = counts.get_alphabet_power();
+}
+
+// merges the two lightest nodes until one is left. leaves sorted once by frequency form one queue,
+// parents form a second one that is sorted by construction, so each merge is O(1) after the sort.
+// ties go to leaves first, then to the earlier node, which gives the same trees the original
+// stable re-sort of a single list did
 void huffman_tree::build() {
-    std::map<char, int>::iterator iter = chars_frequency_.begin();
-    for (; iter != chars_frequency_.end(); ++iter) {
-        huffman_tree_node* node = new huffman_tree_node(iter->first, iter->second);
-        list_of_nodes_.push_back(node);
+    destroy(root_);
+
+    // leaves go in signed char order, as the original std::map<char, int> had them,
+    // so trees rebuilt for archives in the original format keep their shape
+    std::array<huffman_tree_node*, 256> leaves;
+    size_t leaf_count = 0;
+    for (int symbol = -128; symbol < 128; ++symbol) {
+        uint64_t frequency = chars_frequency_[static_cast<uint8_t>(symbol)];
+        if (frequency != 0) {
+            leaves[leaf_count++] = make_node(static_cast<char>(symbol), frequency);
+        }
     }
+    // leaves were made in that order, so breaking ties by slot keeps the sort stable without a buffer
+    std::sort(
+        leaves.begin(),
+        leaves.begin() + leaf_count,
+        [](const huffman_tree_node* node1, const huffman_tree_node* node2) {
+            return node1->get_frequency() < node2->get_frequency() ||
+                   (node1->get_frequency() == node2->get_frequency() && node1 < node2);
+        }
+    );
 
-    // connects two nodes into one parent
-    while (list_of_nodes_.size() != 1) {
-        list_of_nodes_.sort(node_comparing());
-        huffman_tree_node* left_child = list_of_nodes_.front();
-        list_of_nodes_.pop_front();
-        huffman_tree_node* right_child = list_of_nodes_.front();
-        list_of_nodes_.pop_front();
+    if (leaf_count == 0) {
+        root_ = nullptr;
+        return;
+    }
 
-        huffman_tree_node* parent = new huffman_tree_node(left_child, right_child);
-        list_of_nodes_.push_back(parent);
+    // parents are made one after another right behind the leaves, so the pool itself is their queue
+    huffman_tree_node* parents = &nodes_[leaf_count];
+    size_t next_leaf = 0;
+    size_t next_parent = 0;
+
+    auto take_lightest = [&]() {
+        if (next_parent == node_count_ - leaf_count ||
+            (next_leaf != leaf_count && leaves[next_leaf]->get_frequency() <= parents[next_parent].get_frequency())) {
+            return leaves[next_leaf++];
+        }
+        return &parents[next_parent++];
+    };
+
+    // connects two nodes into one parent
+    for (size_t merges = 1; merges < leaf_count; ++merges) {
+        huffman_tree_node* left_child = take_lightest();
+        huffman_tree_node* right_child = take_lightest();
+        make_node(left_child, right_child);
     }
-    root_ = list_of_nodes_.front();
+    root_ = &nodes_[node_count_ - 1];
 }
 
-huffman_tree_node* huffman_tree_node::get_left_child() const { return left_child_; }
+huffman_tree_node* huffman_tree_node::get_left_child() const {
+    return left_offset_ == 0 ? nullptr : const_cast<huffman_tree_node*>(this + left_offset_);
+}
 
-huffman_tree_node* huffman_tree_node::get_right_child() const { return right_child_; }
+huffman_tree_node* huffman_tree_node::get_right_child() const {
+    return right_offset_ == 0 ? nullptr : const_cast<huffman_tree_node*>(this + right_offset_);
+}
 
 char huffman_tree_node::get_symbol() const { return symbol_; }
 
@@ -75,10 +142,18 @@ std::map<char, std::string> huffman_tree::get_table() const { return table_; }
 
 void huffman_tree::set_alphabet_power(const int value) { alphabet_power_ = value; }
 
-void huffman_tree::add_symbol(const char symbol, const int frequency) { chars_frequency_.insert({symbol, frequency}); }
+void huffman_tree::add_symbol(const char symbol, const int frequency) {
+    uint64_t& count = chars_frequency_[static_cast<uint8_t>(symbol)];
+    if (count == 0) {
+        count = frequency;
+    }
+}
 
 // builds table with binary codes
-void huffman_tree::build_table() { build_code(root_, ""); }
+void huffman_tree::build_table() {
+    table_.clear();
+    build_code(root_, "");
+}
 
 void huffman_tree::build_code(huffman_tree_node* node, std::string code) {
     if (node == nullptr) {
@@ -98,16 +173,198 @@ void huffman_tree::build_code(huffman_tree_node* node, std::string code) {
     build_code(node->get_right_child(), code + "1");
 }
 
-void huffman_tree::destroy(const huffman_tree_node* start_node) {
-    if (start_node == nullptr) {
+std::array<huffman_code, 256> huffman_tree::get_codes() const {
+    std::array<huffman_code, 256> codes{};
+    for (const auto& element : table_) {
+        if (element.second.size() > 32) {
+            throw std::runtime_error("Code is too long for the bit writer!");
+        }
+
+        huffman_code& code = codes[static_cast<uint8_t>(element.first)];
+        for (char bit : element.second) {
+            code.bits = (code.bits << 1) | (bit - '0');
+        }
+        code.length = element.second.size();
+    }
+    return codes;
+}
+
+std::array<uint8_t, 256> huffman_tree::get_code_lengths() const {
+    std::array<uint8_t, 256> lengths{};
+    if (root_ == nullptr) {
+        return lengths;
+    }
+
+    // the tree has at most 256 leaves, so its depth fits a byte and the walk needs no allocation
+    std::array<std::pair<const huffman_tree_node*, uint8_t>, kMaxNodes> pending;
+    size_t pending_count = 0;
+    pending[pending_count++] = {root_, 0};
+    while (pending_count != 0) {
+        auto [node, depth] = pending[--pending_count];
+        if (node->get_left_child() == nullptr && node->get_right_child() == nullptr) {
+            lengths[static_cast<uint8_t>(node->get_symbol())] = std::max<uint8_t>(depth, 1);
+            continue;
+        }
+        if (node->get_left_child() != nullptr) {
+            pending[pending_count++] = {node->get_left_child(), depth + 1};
+        }
+        if (node->get_right_child() != nullptr) {
+            pending[pending_count++] = {node->get_right_child(), depth + 1};
+        }
+    }
+    return lengths;
+}
+
+void build_code_lengths(const uint64_t* counts, size_t alphabet_size, uint8_t* lengths, int max_length) {
+    build_code_lengths(counts, alphabet_size, lengths);
+    if (*std::max_element(lengths, lengths + alphabet_size) <= max_length) {
+        return;
+    }
+
+    std::vector<size_t> symbols;
+    for (size_t symbol = 0; symbol < alphabet_size; ++symbol) {
+        if (counts[symbol] != 0) {
+            symbols.push_back(symbol);
+        }
+    }
+    if (symbols.size() > (size_t(1) << max_length)) {
+        throw std::runtime_error("Code length limit is too small for the alphabet!");
+    }
+    std::stable_sort(symbols.begin(), symbols.end(), [counts](size_t first, size_t second) {
+        return counts[first] < counts[second];
+    });
+
+    // package-merge: the list of the deepest level holds the leaves, every shallower level merges the
+    // leaves with packages made of pairs of the level below. the cheapest 2n - 2 items of the top level
+    // make the optimal limited code, and a symbol's length is the number of levels its leaf is taken at.
+    // taken items always form a prefix, so per level it's enough to know which items are leaves
+    std::vector<std::vector<bool>> is_leaf(max_length);
+    std::vector<uint64_t> level(symbols.size());
+    for (size_t i = 0; i < symbols.size(); ++i) {
+        level[i] = counts[symbols[i]];
+    }
+    is_leaf[max_length - 1].assign(symbols.size(), true);
+
+    for (int depth = max_length - 2; depth >= 0; --depth) {
+        std::vector<uint64_t> merged;
+        size_t leaf = 0;
+        size_t package = 0;
+        while (leaf < symbols.size() || package + 1 < level.size()) {
+            uint64_t package_weight = package + 1 < level.size() ? level[package] + level[package + 1] : 0;
+            if (leaf < symbols.size() && (package + 1 >= level.size() || counts[symbols[leaf]] <= package_weight)) {
+                merged.push_back(counts[symbols[leaf++]]);
+                is_leaf[depth].push_back(true);
+            } else {
+                merged.push_back(package_weight);
+                is_leaf[depth].push_back(false);
+                package += 2;
+            }
+        }
+        level = std::move(merged);
+    }
+
+    std::fill(lengths, lengths + alphabet_size, 0);
+    size_t taken = 2 * symbols.size() - 2;
+    for (int depth = 0; depth < max_length && taken != 0; ++depth) {
+        size_t packages = 0;
+        size_t leaves = 0;
+        for (size_t i = 0; i < taken; ++i) {
+            if (is_leaf[depth][i]) {
+                lengths[symbols[leaves++]] += 1;
+            } else {
+                packages += 1;
+            }
+        }
+        taken = 2 * packages;
+    }
+}
+
+void build_code_lengths(const uint64_t* counts, size_t alphabet_size, uint8_t* lengths) {
+    struct node {
+        uint64_t weight;
+        size_t parent;
+    };
+
+    std::vector<size_t> symbols;
+    for (size_t symbol = 0; symbol < alphabet_size; ++symbol) {
+        lengths[symbol] = 0;
+        if (counts[symbol] != 0) {
+            symbols.push_back(symbol);
+        }
+    }
+    if (symbols.size() <= 1) {
+        for (size_t symbol : symbols) {
+            lengths[symbol] = 1;
+        }
         return;
     }
+    std::stable_sort(symbols.begin(), symbols.end(), [counts](size_t first, size_t second) {
+        return counts[first] < counts[second];
+    });
+
+    // leaves take the first n slots in weight order, parents the next n - 1 in creation order
+    size_t leaf_count = symbols.size();
+    std::vector<node> nodes(2 * leaf_count - 1);
+    for (size_t i = 0; i < leaf_count; ++i) {
+        nodes[i].weight = counts[symbols[i]];
+    }
+
+    size_t next_leaf = 0;
+    size_t next_parent = leaf_count;
+    for (size_t created = leaf_count; created < nodes.size(); ++created) {
+        uint64_t weight = 0;
+        for (int child = 0; child < 2; ++child) {
+            size_t lightest = next_parent == created ||
+                                      (next_leaf != leaf_count && nodes[next_leaf].weight <= nodes[next_parent].weight)
+                                  ? next_leaf++
+                                  : next_parent++;
+            nodes[lightest].parent = created;
+            weight += nodes[lightest].weight;
+        }
+        nodes[created].weight = weight;
+    }
+
+    // parents come after their children, so one backward pass turns parent links into depths
+    std::vector<uint8_t> depth(nodes.size());
+    depth.back() = 0;
+    for (size_t i = nodes.size() - 1; i-- > 0;) {
+        depth[i] = depth[nodes[i].parent] + 1;
+    }
+    for (size_t i = 0; i < leaf_count; ++i) {
+        lengths[symbols[i]] = depth[i];
+    }
+}
+
+std::array<huffman_code, 256> build_canonical_codes(const std::array<uint8_t, 256>& lengths) {
+    std::array<int, 33> length_count{};
+    for (uint8_t length : lengths) {
+        if (length > 32) {
+            throw std::runtime_error("Code is too long!");
+        }
+        length_count[length] += 1;
+    }
+    length_count[0] = 0;
 
-    destroy(start_node->get_left_child());
-    destroy(start_node->get_right_child());
+    // first code of every length
+    std::array<uint32_t, 34> next_code{};
+    uint32_t code = 0;
+    for (int length = 1; length <= 32; ++length) {
+        code = (code + length_count[length - 1]) << 1;
+        next_code[length] = code;
+    }
+
+    std::array<huffman_code, 256> codes{};
+    for (int symbol = 0; symbol < 256; ++symbol) {
+        if (lengths[symbol] != 0) {
+            codes[symbol] = {next_code[lengths[symbol]]++, lengths[symbol]};
+        }
+    }
+    return codes;
+}
 
-    delete start_node;
-    start_node = nullptr;
+void huffman_tree::destroy(const huffman_tree_node*) {
+    node_count_ = 0;
+    root_ = nullptr;
 }
 
 }  // namespace huffman
@@ -0,0 +1,103 @@
+#include "input_source.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+
+namespace huffman {
+
+mapped_file::mapped_file(const std::string& filename) : data_(nullptr), size_(0), mapped_(false) {
+    // pipes and devices aren't opened here: a fifo opened twice loses its writer to the first open
+    struct stat status;
+    if (stat(filename.c_str(), &status) != 0) {
+        throw std::runtime_error("Input file can't be opened!");
+    }
+    if (!S_ISREG(status.st_mode)) {
+        return;
+    }
+
+    int descriptor = open(filename.c_str(), O_RDONLY);
+    if (descriptor < 0) {
+        throw std::runtime_error("Input file can't be opened!");
+    }
+
+    if (fstat(descriptor, &status) == 0 && S_ISREG(status.st_mode)) {
+        size_ = status.st_size;
+        mapped_ = true;
+        if (size_ != 0) {
+            void* mapping = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, descriptor, 0);
+            if (mapping == MAP_FAILED) {
+                size_ = 0;
+                mapped_ = false;
+            } else {
+                madvise(mapping, size_, MADV_SEQUENTIAL);
+                data_ = static_cast<const uint8_t*>(mapping);
+            }
+        }
+    }
+
+    // the mapping stays valid after the descriptor is closed
+    close(descriptor);
+}
+
+mapped_file::~mapped_file() {
+    if (data_ != nullptr) {
+        munmap(const_cast<uint8_t*>(data_), size_);
+    }
+}
+
+bool mapped_file::is_mapped() const { return mapped_; }
+
+const uint8_t* mapped_file::get_data() const { return data_; }
+
+size_t mapped_file::get_size() const { return size_; }
+
+std::vector<uint8_t> read_file(const std::string& filename) {
+    std::ifstream input(filename, std::ios_base::binary);
+    if (!input) {
+        throw std::runtime_error("Input file can't be opened!");
+    }
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+}
+
+input_source::input_source(const std::string& filename)
+    : mapping_(std::make_unique<mapped_file>(filename)),
+      data_(mapping_->get_data()),
+      size_(mapping_->get_size()),
+      position_(0),
+      stream_(nullptr) {
+    if (!mapping_->is_mapped()) {
+        file_stream_.open(filename, std::ios_base::binary);
+        if (!file_stream_) {
+            throw std::runtime_error("Input file can't be opened!");
+        }
+        stream_ = &file_stream_;
+    }
+}
+
+input_source::input_source(std::istream& stream) : data_(nullptr), size_(0), position_(0), stream_(&stream) {}
+
+input_source::input_source(const uint8_t* data, size_t size)
+    : data_(data), size_(size), position_(0), stream_(nullptr) {}
+
+input_block input_source::next_block(size_t max_size) {
+    if (stream_ == nullptr) {
+        size_t size = std::min(max_size, size_ - position_);
+        input_block block{data_ + position_, size, {}};
+        position_ += size;
+        return block;
+    }
+
+    input_block block{nullptr, 0, std::vector<uint8_t>(max_size)};
+    stream_->read(reinterpret_cast<char*>(block.storage.data()), max_size);
+    block.storage.resize(stream_->gcount());
+    block.data = block.storage.data();
+    block.size = block.storage.size();
+    return block;
+}
+
+}  // namespace huffman
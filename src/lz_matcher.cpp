@@ -0,0 +1,121 @@
+#include "lz_matcher.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace huffman {
+
+namespace {
+
+struct level_parameters {
+    int chain_depth;       // earlier positions tried for a match
+    uint32_t nice_length;  // a match this long is taken without looking further
+};
+
+constexpr level_parameters kLevels[kMaxLzLevel] = {
+    {1, 16}, {2, 32}, {4, 32}, {8, 64}, {16, 128}, {32, 128}, {64, 258}, {128, 258}, {512, 1024},
+};
+
+uint32_t read32(const uint8_t* data) {
+    uint32_t word;
+    std::memcpy(&word, data, sizeof(word));
+    return word;
+}
+
+uint32_t hash(const uint8_t* data, int hash_bits) { return (read32(data) * 2654435761u) >> (32 - hash_bits); }
+
+// common prefix of a and b, compared a word at a time
+uint32_t match_length(const uint8_t* a, const uint8_t* b, uint32_t limit) {
+    uint32_t length = 0;
+    while (length + 8 <= limit) {
+        uint64_t x, y;
+        std::memcpy(&x, a + length, sizeof(x));
+        std::memcpy(&y, b + length, sizeof(y));
+        if (x != y) {
+            return length + (__builtin_ctzll(x ^ y) >> 3);
+        }
+        length += 8;
+    }
+    while (length < limit && a[length] == b[length]) {
+        length += 1;
+    }
+    return length;
+}
+
+// literal runs longer than a sequence holds are split off as sequences without a match
+void add_sequence(uint32_t literals, uint32_t match_length, uint32_t distance, std::vector<lz_sequence>& sequences) {
+    while (literals > kLzMaxLength) {
+        sequences.push_back({kLzMaxLength, 0, 0});
+        literals -= kLzMaxLength;
+    }
+    sequences.push_back({literals, match_length, distance});
+}
+
+}  // namespace
+
+void find_matches(const uint8_t* data, size_t size, int level, std::vector<lz_sequence>& sequences) {
+    if (level < 1 || level > kMaxLzLevel) {
+        throw std::runtime_error("Match finder level is out of range!");
+    }
+    const level_parameters& parameters = kLevels[level - 1];
+    sequences.clear();
+
+    // small blocks get a small head table, so they don't pay for clearing a large one
+    int hash_bits = 10;
+    while (hash_bits < 16 && (size_t(1) << hash_bits) < size) {
+        hash_bits += 1;
+    }
+    std::vector<int32_t> head(size_t(1) << hash_bits, -1);
+    std::vector<int32_t> previous(size);
+
+    auto insert = [&](size_t position) {
+        uint32_t h = hash(data + position, hash_bits);
+        previous[position] = head[h];
+        head[h] = static_cast<int32_t>(position);
+    };
+
+    size_t position = 0, literal_start = 0;
+    while (position + kLzMinMatch <= size) {
+        uint32_t limit = std::min<size_t>(size - position, kLzMaxLength);
+        uint32_t best_length = 0, best_distance = 0;
+        int32_t candidate = head[hash(data + position, hash_bits)];
+        for (int depth = parameters.chain_depth; candidate >= 0 && depth > 0; --depth) {
+            uint32_t distance = position - candidate;
+            if (distance > kLzWindow) {
+                break;
+            }
+            // a candidate can only do better if it also matches the byte the best one stopped at
+            if (data[candidate + best_length] == data[position + best_length]) {
+                uint32_t length = match_length(data + candidate, data + position, limit);
+                if (length > best_length) {
+                    best_length = length;
+                    best_distance = distance;
+                    if (length >= parameters.nice_length || length == limit) {
+                        break;
+                    }
+                }
+            }
+            candidate = previous[candidate];
+        }
+        insert(position);
+
+        if (best_length < kLzMinMatch) {
+            position += 1;
+            continue;
+        }
+        add_sequence(position - literal_start, best_length, best_distance, sequences);
+        size_t match_end = position + best_length;
+        for (position += 1; position < match_end && position + kLzMinMatch <= size; ++position) {
+            insert(position);
+        }
+        position = match_end;
+        literal_start = position;
+    }
+
+    if (literal_start < size || sequences.empty()) {
+        add_sequence(size - literal_start, 0, 0, sequences);
+    }
+}
+
+}  // namespace huffman
@@ -1,82 +1,409 @@
 #include "encoding.h"
+#include "file_archive.h"
+#include "file_output.h"
 
+#include <algorithm>
 #include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <optional>
 #include <stdexcept>
+#include <utility>
+#include <vector>
+
+// a malformed command line, answered with the usage text
+class argument_error : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// "-" stands for standard input or output
+bool is_standard_stream(const std::string& filename) { return filename == "-"; }
 
 bool is_file_empty(const std::string& filename) {
+    if (is_standard_stream(filename)) {
+        return std::cin.peek() == std::istream::traits_type::eof();
+    }
     std::ifstream in(filename);
     return in.peek() == std::ifstream::traits_type::eof();
 }
 
-void compress(std::string input_file, std::string output_file) {
-    huffman::huffman_compressor compressor;
-    compressor.compress_file(input_file, output_file);
+// accepts a plain number of bytes or one with a k / m suffix
+size_t parse_size(const char* value) {
+    char* end;
+    size_t size = strtoull(value, &end, 10);
+    if (end == value) {
+        throw argument_error("Incorrect size!");
+    }
+
+    if (*end == 'k' || *end == 'K') {
+        size <<= 10;
+        end++;
+    } else if (*end == 'm' || *end == 'M') {
+        size <<= 20;
+        end++;
+    }
+    if (*end != '\0') {
+        throw argument_error("Incorrect size!");
+    }
+    return size;
+}
+
+// offset:length, both taking the suffixes of parse_size
+std::pair<uint64_t, uint64_t> parse_range(const char* value) {
+    const char* separator = strchr(value, ':');
+    if (separator == nullptr) {
+        throw argument_error("Incorrect range!");
+    }
+    return {parse_size(std::string(value, separator).c_str()), parse_size(separator + 1)};
+}
+
+void compress(std::string input_file, std::string output_file, const huffman::compression_options& options) {
+    huffman::huffman_compressor compressor(options);
+    if (!is_standard_stream(input_file) && !is_standard_stream(output_file)) {
+        compressor.compress_file(input_file, output_file);
+        return;
+    }
+
+    std::ifstream input;
+    std::ofstream output;
+    if (!is_standard_stream(input_file)) {
+        input.open(input_file, std::ios_base::binary);
+    }
+    if (!is_standard_stream(output_file)) {
+        output.open(output_file, std::ios_base::binary);
+    }
+    compressor.compress_stream(
+        is_standard_stream(input_file) ? std::cin : input, is_standard_stream(output_file) ? std::cout : output
+    );
+}
+
+void decompress(std::string input_file, std::string output_file, const huffman::decompression_options& options) {
+    huffman::huffman_decompressor decompressor(options);
+    if (!is_standard_stream(input_file) && !is_standard_stream(output_file)) {
+        decompressor.decompress_file(input_file, output_file);
+        return;
+    }
+
+    std::ifstream input;
+    std::ofstream output;
+    if (!is_standard_stream(input_file)) {
+        input.open(input_file, std::ios_base::binary);
+    }
+    if (!is_standard_stream(output_file)) {
+        output.open(output_file, std::ios_base::binary);
+    }
+    decompressor.decompress_stream(
+        is_standard_stream(input_file) ? std::cin : input, is_standard_stream(output_file) ? std::cout : output
+    );
+}
+
+// only the blocks holding the range are read, so the archive has to be a file
+void decompress_range(
+    const std::string& input_file,
+    const std::string& output_file,
+    std::pair<uint64_t, uint64_t> range,
+    const huffman::decompression_options& options
+) {
+    if (is_standard_stream(input_file)) {
+        throw argument_error("Range needs an input file!");
+    }
+    huffman::huffman_decompressor decompressor(options);
+    if (is_standard_stream(output_file)) {
+        decompressor.decompress_range(input_file, range.first, range.second, std::cout);
+    } else {
+        huffman::file_output_buffer buffer(output_file, options.direct_output);
+        std::ostream output(&buffer);
+        decompressor.decompress_range(input_file, range.first, range.second, output);
+        buffer.close();
+    }
 }
 
-void decompress(std::string input_file, std::string output_file) {
-    huffman::huffman_decompressor decompressor;
-    decompressor.decompress_file(input_file, output_file);
+// trains on every regular file under sample_dir
+void train(const std::string& sample_dir, std::string output_file, int max_code_length) {
+    std::vector<std::string> sample_files;
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(sample_dir)) {
+        if (entry.is_regular_file()) {
+            sample_files.push_back(entry.path().string());
+        }
+    }
+    if (sample_files.empty()) {
+        throw std::runtime_error("No sample files to train on!");
+    }
+
+    huffman::dictionary trained = huffman::dictionary::train(sample_files, max_code_length);
+    if (is_standard_stream(output_file)) {
+        trained.save(std::cout);
+    } else {
+        std::ofstream output(output_file, std::ios_base::binary);
+        trained.save(output);
+    }
+}
+
+// packs path, a file or every regular file under a directory, names are kept relative to path
+void pack(const std::string& path, const std::string& output_file, const huffman::compression_options& options) {
+    if (is_standard_stream(output_file)) {
+        throw argument_error("Archive needs an output file!");
+    }
+    huffman::archive_writer writer(output_file, options);
+    if (!std::filesystem::is_directory(path)) {
+        writer.add_file(path, std::filesystem::path(path).filename().generic_string());
+    } else {
+        std::vector<std::filesystem::path> files;
+        for (const auto& entry : std::filesystem::recursive_directory_iterator(path)) {
+            if (entry.is_regular_file()) {
+                files.push_back(entry.path());
+            }
+        }
+        // directory order depends on the file system, the archive shouldn't
+        std::sort(files.begin(), files.end());
+        for (const auto& file : files) {
+            writer.add_file(file.string(), std::filesystem::relative(file, path).generic_string());
+        }
+    }
+    writer.finish();
+}
+
+void list(const std::string& input_file, const huffman::decompression_options& options) {
+    huffman::archive_reader reader(input_file, options);
+    for (const huffman::archive_member& member : reader.get_members()) {
+        std::cout << member.name << ' ' << member.original_size << ' ' << member.compressed_size << '\n';
+    }
+    std::cout.flush();
+}
+
+// a stored name must stay inside the output directory
+bool is_safe_member_name(const std::string& name) {
+    std::filesystem::path path(name);
+    if (path.is_absolute() || path.has_root_name()) {
+        return false;
+    }
+    for (const auto& part : path) {
+        if (part == "..") {
+            return false;
+        }
+    }
+    return true;
+}
+
+// a member that fails to extract leaves no partial file behind
+void extract_file(
+    huffman::archive_reader& reader,
+    const huffman::archive_member& member,
+    const std::filesystem::path& path,
+    bool direct_output
+) {
+    try {
+        huffman::file_output_buffer buffer(path.string(), direct_output);
+        std::ostream output(&buffer);
+        reader.extract(member, output);
+        buffer.close();
+    } catch (...) {
+        std::error_code error;
+        std::filesystem::remove(path, error);
+        throw;
+    }
+}
+
+// extracts a single member to output_file, or every member under the output_file directory
+void unpack(
+    const std::string& input_file,
+    std::string output_file,
+    const std::string& member_name,
+    const huffman::decompression_options& options
+) {
+    huffman::archive_reader reader(input_file, options);
+    if (!member_name.empty()) {
+        const huffman::archive_member* member = reader.find(member_name);
+        if (member == nullptr) {
+            throw std::runtime_error("No such member in the archive!");
+        }
+        if (is_standard_stream(output_file)) {
+            reader.extract(*member, std::cout);
+            std::cout.flush();
+        } else {
+            extract_file(reader, *member, output_file, options.direct_output);
+        }
+        return;
+    }
+
+    std::filesystem::path directory = is_standard_stream(output_file) ? "." : output_file;
+    for (const huffman::archive_member& member : reader.get_members()) {
+        if (!is_safe_member_name(member.name)) {
+            throw std::runtime_error("Member name leaves the output directory!");
+        }
+        std::filesystem::path path = directory / member.name;
+        if (path.has_parent_path()) {
+            std::filesystem::create_directories(path.parent_path());
+        }
+        extract_file(reader, member, path, options.direct_output);
+    }
 }
 
 int main(int argc, char** argv) {
     try {
-        std::string mode, input_file, output_file;
-
-        if (argc == 6) {
-            for (int i = 1; i < 6; i++) {
-                if (!strcmp(argv[i], "-c")) {
-                    mode = argv[i];
-                } else if (!strcmp(argv[i], "-d")) {
-                    mode = argv[i];
-                } else if (!strcmp(argv[i], "-f") || !strcmp(argv[i], "--file")) {
-                    input_file = argv[i + 1];
-                    i++;
-
-                    if (!std::filesystem::exists(input_file)) {
-                        throw std::runtime_error("Input file does not exist!");
-                    }
-                } else if (!strcmp(argv[i], "-o") || !strcmp(argv[i], "--output")) {
-                    output_file = argv[i + 1];
-                    i++;
-                } else {
-                    throw std::runtime_error("Incorrect argument!");
+        std::string mode, input_file = "-", output_file = "-", sample_dir, dictionary_file, pack_path, member_name;
+        huffman::compression_options options;
+        huffman::decompression_options decompression_options;
+        int dictionary_code_length = huffman::kDefaultDictionaryCodeLength;
+        std::optional<std::pair<uint64_t, uint64_t>> range;
+
+        for (int i = 1; i < argc; i++) {
+            bool has_value = i + 1 < argc;
+            if (!strcmp(argv[i], "-c")) {
+                mode = argv[i];
+            } else if (!strcmp(argv[i], "-d")) {
+                mode = argv[i];
+            } else if (!strcmp(argv[i], "--train") && has_value) {
+                mode = argv[i];
+                sample_dir = argv[i + 1];
+                i++;
+            } else if (!strcmp(argv[i], "--pack") && has_value) {
+                mode = argv[i];
+                pack_path = argv[i + 1];
+                i++;
+            } else if (!strcmp(argv[i], "--list") || !strcmp(argv[i], "--unpack")) {
+                mode = argv[i];
+            } else if (!strcmp(argv[i], "--range") && has_value) {
+                range = parse_range(argv[i + 1]);
+                i++;
+            } else if (!strcmp(argv[i], "--member") && has_value) {
+                member_name = argv[i + 1];
+                i++;
+            } else if (!strcmp(argv[i], "--dictionary") && has_value) {
+                dictionary_file = argv[i + 1];
+                i++;
+            } else if ((!strcmp(argv[i], "-f") || !strcmp(argv[i], "--file")) && has_value) {
+                input_file = argv[i + 1];
+                i++;
+
+                if (!is_standard_stream(input_file) && !std::filesystem::exists(input_file)) {
+                    throw argument_error("Input file does not exist!");
                 }
+            } else if ((!strcmp(argv[i], "-o") || !strcmp(argv[i], "--output")) && has_value) {
+                output_file = argv[i + 1];
+                i++;
+            } else if (!strcmp(argv[i], "--block-size") && has_value) {
+                options.block_size = parse_size(argv[i + 1]);
+                i++;
+            } else if (!strcmp(argv[i], "--max-code-length") && has_value) {
+                options.max_code_length = parse_size(argv[i + 1]);
+                dictionary_code_length = options.max_code_length;
+                i++;
+            } else if (!strcmp(argv[i], "--streams") && has_value) {
+                options.streams = parse_size(argv[i + 1]);
+                i++;
+            } else if (!strcmp(argv[i], "--context-order") && has_value) {
+                options.context_order = parse_size(argv[i + 1]);
+                i++;
+            } else if (!strcmp(argv[i], "--lz") && has_value) {
+                options.lz_level = parse_size(argv[i + 1]);
+                i++;
+            } else if (!strcmp(argv[i], "--seek-interval") && has_value) {
+                options.seek_interval = parse_size(argv[i + 1]);
+                i++;
+            } else if (!strcmp(argv[i], "--direct")) {
+                options.direct_output = true;
+                decompression_options.direct_output = true;
+            } else if (!strcmp(argv[i], "--threads") && has_value) {
+                options.threads = parse_size(argv[i + 1]);
+                decompression_options.threads = options.threads;
+                i++;
+            } else {
+                throw argument_error("Incorrect argument!");
             }
-        } else {
-            throw std::runtime_error("Incorrect arguments!");
+        }
+
+        // the sizes summary must not mix with archive data on standard output
+        std::ostream& report = is_standard_stream(output_file) ? std::cerr : std::cout;
+        options.size_report = &report;
+        decompression_options.size_report = &report;
+        if (is_standard_stream(input_file) || is_standard_stream(output_file)) {
+            std::ios_base::sync_with_stdio(false);
+        }
+
+        std::unique_ptr<huffman::dictionary> shared_table;
+        if (!dictionary_file.empty()) {
+            std::ifstream input(dictionary_file, std::ios_base::binary);
+            if (!input) {
+                throw argument_error("Dictionary file does not exist!");
+            }
+            shared_table = std::make_unique<huffman::dictionary>(huffman::dictionary::load(input));
+            options.shared_table = shared_table.get();
+            decompression_options.shared_table = shared_table.get();
         }
 
         if (mode == "-c") {
-            if (!std::filesystem::exists(input_file)) {
-                throw std::runtime_error("Input file doesn't exist!");
+            if (!is_standard_stream(input_file) && !std::filesystem::exists(input_file)) {
+                throw argument_error("Input file doesn't exist!");
             }
-            if (is_file_empty(input_file)) {
-                std::cout << 0 << '\n' << 0 << '\n' << 0 << std::endl;
-                std::ofstream out(output_file, std::ios_base::binary);
+            if (!is_standard_stream(input_file) && is_file_empty(input_file)) {
+                // empty in, empty out: -d turns an empty input back into nothing as well
+                report << 0 << '\n' << 0 << '\n' << 0 << std::endl;
+                if (!is_standard_stream(output_file)) {
+                    std::ofstream out(output_file, std::ios_base::binary);
+                }
                 return 0;
             }
-            compress(input_file, output_file);
+            compress(input_file, output_file, options);
         } else if (mode == "-d") {
-            if (!std::filesystem::exists(input_file)) {
-                throw std::runtime_error("Input file doesn't exist!");
+            if (!is_standard_stream(input_file) && !std::filesystem::exists(input_file)) {
+                throw argument_error("Input file doesn't exist!");
             }
             if (is_file_empty(input_file)) {
-                std::cout << 0 << '\n' << 0 << '\n' << 0 << std::endl;
-                std::ofstream out(output_file);
+                report << 0 << '\n' << 0 << '\n' << 0 << std::endl;
+                if (!is_standard_stream(output_file)) {
+                    std::ofstream out(output_file);
+                }
                 return 0;
             }
-            decompress(input_file, output_file);
+            if (range) {
+                decompress_range(input_file, output_file, *range, decompression_options);
+            } else {
+                decompress(input_file, output_file, decompression_options);
+            }
+        } else if (mode == "--train") {
+            train(sample_dir, output_file, dictionary_code_length);
+        } else if (mode == "--pack") {
+            if (!std::filesystem::exists(pack_path)) {
+                throw argument_error("Input file doesn't exist!");
+            }
+            pack(pack_path, output_file, options);
+        } else if (mode == "--list" || mode == "--unpack") {
+            // the archive is mapped, so it has to be a file
+            if (is_standard_stream(input_file)) {
+                throw argument_error("Archive needs an input file!");
+            }
+            if (mode == "--list") {
+                list(input_file, decompression_options);
+            } else {
+                unpack(input_file, output_file, member_name, decompression_options);
+            }
         } else {
-            throw std::runtime_error("Unknown mode!");
+            throw argument_error("Unknown mode!");
         }
-    } catch (std::runtime_error const&) {
-        std::cout << "Incorrect arguments!\nUsage:\nTo compress file: " << argv[0]
-                  << " -c -f <decompressed_file> -o <compressed_file>"
-                  << "\nTo decompress file: " << argv[0] << " -d -f <compressed_file> -o <decompressed_file>"
-                  << std::endl;
+    } catch (argument_error const&) {
+        std::cerr << "Incorrect arguments!\nUsage:\nTo compress file: " << argv[0]
+                  << " -c -f <decompressed_file> -o <compressed_file> [--block-size <size>] [--max-code-length <bits>]"
+                  << " [--streams <count>] [--context-order <0|1>] [--lz <level>] [--seek-interval <size>]"
+                  << " [--dictionary <dictionary_file>] [--threads <count>] [--direct]"
+                  << "\nTo decompress file: " << argv[0]
+                  << " -d -f <compressed_file> -o <decompressed_file> [--range <offset>:<length>]"
+                  << " [--dictionary <dictionary_file>] [--threads <count>] [--direct]"
+                  << "\nTo train a dictionary: " << argv[0]
+                  << " --train <sample_dir> -o <dictionary_file> [--max-code-length <bits>]"
+                  << "\nTo pack files into an archive: " << argv[0]
+                  << " --pack <file_or_dir> -o <archive> [compression options]"
+                  << "\nTo list an archive: " << argv[0] << " --list -f <archive>"
+                  << "\nTo unpack an archive: " << argv[0]
+                  << " --unpack -f <archive> [-o <dir>] | --unpack -f <archive> --member <name> [-o <file>]"
+                  << "\nInput and output default to standard streams, \"-\" selects them explicitly." << std::endl;
+        return 1;
+    } catch (std::exception const& error) {
+        std::cerr << error.what() << std::endl;
+        return 1;
     }
 
     return 0;
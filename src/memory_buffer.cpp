@@ -0,0 +1,63 @@
+#include "memory_buffer.h"
+
+namespace huffman {
+
+input_memory_buffer::input_memory_buffer(const uint8_t* data, size_t size) {
+    // the get area is never written through
+    char* begin = reinterpret_cast<char*>(const_cast<uint8_t*>(data));
+    setg(begin, begin, begin + size);
+}
+
+std::streambuf::pos_type input_memory_buffer::seekoff(
+    off_type offset,
+    std::ios_base::seekdir direction,
+    std::ios_base::openmode which
+) {
+    if (!(which & std::ios_base::in)) {
+        return pos_type(off_type(-1));
+    }
+
+    off_type base = direction == std::ios_base::beg   ? 0
+                    : direction == std::ios_base::cur ? gptr() - eback()
+                                                      : egptr() - eback();
+    off_type position = base + offset;
+    if (position < 0 || position > egptr() - eback()) {
+        return pos_type(off_type(-1));
+    }
+    setg(eback(), eback() + position, egptr());
+    return pos_type(position);
+}
+
+std::streambuf::pos_type input_memory_buffer::seekpos(pos_type position, std::ios_base::openmode which) {
+    return seekoff(off_type(position), std::ios_base::beg, which);
+}
+
+output_memory_buffer::output_memory_buffer(uint8_t* data, size_t capacity) : output_(nullptr), output_start_(0) {
+    char* begin = reinterpret_cast<char*>(data);
+    setp(begin, begin + capacity);
+}
+
+output_memory_buffer::output_memory_buffer(std::vector<uint8_t>& output)
+    : output_(&output), output_start_(output.size()) {}
+
+size_t output_memory_buffer::get_size() const {
+    return output_ != nullptr ? output_->size() - output_start_ : pptr() - pbase();
+}
+
+std::streambuf::int_type output_memory_buffer::overflow(int_type symbol) {
+    if (output_ == nullptr || traits_type::eq_int_type(symbol, traits_type::eof())) {
+        return traits_type::eof();
+    }
+    output_->push_back(static_cast<uint8_t>(symbol));
+    return symbol;
+}
+
+std::streamsize output_memory_buffer::xsputn(const char* data, std::streamsize size) {
+    if (output_ == nullptr) {
+        return std::streambuf::xsputn(data, size);
+    }
+    output_->insert(output_->end(), data, data + size);
+    return size;
+}
+
+}  // namespace huffman
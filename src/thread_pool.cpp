@@ -0,0 +1,112 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace huffman {
+
+namespace {
+
+// pool and index of the worker running on this thread
+thread_local const thread_pool* current_pool = nullptr;
+thread_local size_t current_worker = 0;
+
+}  // namespace
+
+thread_pool::thread_pool(unsigned threads) : pending_(0), stopping_(false) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    for (unsigned i = 0; i < threads; ++i) {
+        local_.push_back(std::make_unique<worker_queue>());
+    }
+    for (unsigned i = 0; i < threads; ++i) {
+        workers_.emplace_back(&thread_pool::run, this, i);
+    }
+}
+
+thread_pool::~thread_pool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    task_available_.notify_all();
+
+    for (std::thread& worker : workers_) {
+        worker.join();
+    }
+}
+
+unsigned thread_pool::get_thread_count() const { return workers_.size(); }
+
+int thread_pool::get_worker_index() const { return current_pool == this ? static_cast<int>(current_worker) : -1; }
+
+void thread_pool::push(std::function<void()> task) {
+    {
+        // counted before it's published, a worker that takes it at once can't drive the count below zero
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_ += 1;
+        if (current_pool == this) {
+            worker_queue& queue = *local_[current_worker];
+            std::lock_guard<std::mutex> queue_lock(queue.mutex);
+            queue.tasks.push_back(std::move(task));
+        } else {
+            shared_.push(std::move(task));
+        }
+    }
+    task_available_.notify_one();
+}
+
+bool thread_pool::take(size_t worker, std::function<void()>& task) {
+    {
+        worker_queue& own = *local_[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+        }
+    }
+    if (!task) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!shared_.empty()) {
+            task = std::move(shared_.front());
+            shared_.pop();
+            pending_ -= 1;
+            return true;
+        }
+    }
+    for (size_t i = 1; !task && i < local_.size(); ++i) {
+        worker_queue& victim = *local_[(worker + i) % local_.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+        }
+    }
+    if (!task) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_ -= 1;
+    return true;
+}
+
+void thread_pool::run(size_t worker) {
+    current_pool = this;
+    current_worker = worker;
+    while (true) {
+        std::function<void()> task;
+        if (take(worker, task)) {
+            task();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        task_available_.wait(lock, [this]() { return stopping_ || pending_ != 0; });
+        if (pending_ == 0) {
+            return;
+        }
+    }
+}
+
+}  // namespace huffman
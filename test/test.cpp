@@ -1,15 +1,49 @@
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include "doctest.h"
 
+#include "archive_format.h"
+#include "bit_stream.h"
+#include "block_codec.h"
+#include "checksum.h"
+#include "decode_table.h"
+#include "dictionary.h"
 #include "encoding.h"
+#include "file_archive.h"
+#include "file_output.h"
+#include "histogram.h"
 #include "huffman_tree.h"
+#include "lz_matcher.h"
+#include "thread_pool.h"
+
+#include <sys/stat.h>
 
 DOCTEST_MAKE_STD_HEADERS_CLEAN_FROM_WARNINGS_ON_WALL_BEGIN
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
 #include <iterator>
+#include <numeric>
 #include <set>
+#include <sstream>
+#include <thread>
+#include <vector>
 DOCTEST_MAKE_STD_HEADERS_CLEAN_FROM_WARNINGS_ON_WALL_END
 
+// file in the temp directory that is removed when it goes out of scope, so test runs leave samples/ untouched
+class scratch_file {
+public:
+    explicit scratch_file(const std::string& name) : path_((std::filesystem::temp_directory_path() / name).string()) {}
+    ~scratch_file() { std::filesystem::remove(path_); }
+
+    [[nodiscard]] const std::string& get_path() const { return path_; }
+
+private:
+    std::string path_;
+};
+
 bool compareFiles(const std::string& filename1, const std::string& filename2) {
     std::ifstream f1(filename1, std::ifstream::binary | std::ifstream::ate);
     std::ifstream f2(filename2, std::ifstream::binary | std::ifstream::ate);
@@ -50,6 +84,24 @@ TEST_SUITE("Huffman-tree test") {
         CHECK(tree.get_chars_frequency()['q'] == 100);
     }
 
+    TEST_CASE("Frequency table from a pipe test") {
+        // a fifo can't be mapped, it's read as a stream instead
+        std::filesystem::path fifo = std::filesystem::temp_directory_path() / "huffman_frequency_fifo";
+        std::filesystem::remove(fifo);
+        REQUIRE(mkfifo(fifo.c_str(), 0600) == 0);
+        std::thread writer([&fifo]() {
+            std::ofstream output(fifo, std::ios_base::binary);
+            output << "abcddcbaadbcdabc";
+        });
+
+        huffman::huffman_tree tree;
+        tree.build_frequency_table(fifo.string());
+        writer.join();
+        std::filesystem::remove(fifo);
+        CHECK(tree.get_alphabet_power() == 4);
+        CHECK(tree.get_number_of_chars() == 16);
+    }
+
     TEST_CASE("Build code-tree test") {
         huffman::huffman_tree tree;
         tree.build_frequency_table("../samples/frequency_table_test.txt");
@@ -89,6 +141,145 @@ TEST_SUITE("Huffman-tree test") {
         tree.destroy(tree.get_root());
     }
 
+    TEST_CASE("Node pool test") {
+        // every byte value, the largest tree the pool has to hold
+        std::vector<uint8_t> data;
+        for (int symbol = 0; symbol < 256; ++symbol) {
+            data.insert(data.end(), symbol % 7 + 1, static_cast<uint8_t>(symbol));
+        }
+
+        // depth of every leaf, walked from the root
+        auto depths = [](const huffman::huffman_tree_node* root) {
+            std::array<int, 256> depth{};
+            std::vector<std::pair<const huffman::huffman_tree_node*, int>> stack = {{root, 0}};
+            while (!stack.empty()) {
+                auto [node, level] = stack.back();
+                stack.pop_back();
+                if (node->get_left_child() == nullptr) {
+                    depth[static_cast<uint8_t>(node->get_symbol())] = level;
+                    continue;
+                }
+                stack.push_back({node->get_left_child(), level + 1});
+                stack.push_back({node->get_right_child(), level + 1});
+            }
+            return depth;
+        };
+
+        huffman::huffman_tree tree;
+        tree.build_frequency_table(data.data(), data.size());
+        tree.build();
+        std::array<int, 256> first = depths(tree.get_root());
+        CHECK(std::count(first.begin(), first.end(), 0) == 0);
+        CHECK(tree.get_root()->get_frequency() == data.size());
+
+        // rebuilding reuses the pool and gives the same tree
+        huffman::huffman_tree_node* root = tree.get_root();
+        tree.build();
+        CHECK(tree.get_root() == root);
+        CHECK(depths(tree.get_root()) == first);
+
+        // a smaller tree after it leaves nothing of the first one in the code table
+        tree.build_table();
+        CHECK(tree.get_table().size() == 256);
+        std::string two_symbols = "abababa";
+        tree.build_frequency_table(reinterpret_cast<const uint8_t*>(two_symbols.data()), two_symbols.size());
+        tree.build();
+        tree.build_table();
+        CHECK(tree.get_table().size() == 2);
+
+        tree.destroy(tree.get_root());
+        CHECK(tree.get_root() == nullptr);
+
+        // weights are 64-bit, inputs past 2^31 bytes don't wrap them
+        huffman::huffman_tree_node heavy('a', uint64_t(3) << 31);
+        CHECK(heavy.get_frequency() == uint64_t(3) << 31);
+    }
+
+    TEST_CASE("Flat code lengths test") {
+        huffman::huffman_tree tree;
+        tree.build_frequency_table("../samples/big_text_to_compress.txt");
+        tree.build();
+        tree.build_table();
+        std::map<char, std::string> table = tree.get_table();
+        // the tree reports the lengths of the codes it built
+        std::array<uint8_t, 256> tree_lengths = tree.get_code_lengths();
+        for (int symbol = 0; symbol < 256; ++symbol) {
+            auto code = table.find(static_cast<char>(symbol));
+            CHECK(tree_lengths[symbol] == (code == table.end() ? 0 : code->second.size()));
+        }
+        tree.destroy(tree.get_root());
+        CHECK(tree.get_code_lengths() == std::array<uint8_t, 256>{});
+
+        std::array<uint64_t, 256> counts{};
+        for (auto element : tree.get_chars_frequency()) {
+            counts[static_cast<uint8_t>(element.first)] = element.second;
+        }
+        std::array<uint8_t, 256> lengths;
+        huffman::build_code_lengths(counts.data(), counts.size(), lengths.data());
+
+        // both are optimal, ties may be broken differently
+        uint64_t tree_bits = 0, flat_bits = 0;
+        double kraft_sum = 0;
+        for (int symbol = 0; symbol < 256; ++symbol) {
+            tree_bits += counts[symbol] != 0 ? counts[symbol] * table[static_cast<char>(symbol)].size() : 0;
+            flat_bits += counts[symbol] * lengths[symbol];
+            CHECK((counts[symbol] == 0) == (lengths[symbol] == 0));
+            kraft_sum += lengths[symbol] != 0 ? 1.0 / (uint64_t(1) << lengths[symbol]) : 0;
+        }
+        CHECK(flat_bits == tree_bits);
+        CHECK(kraft_sum == doctest::Approx(1.0));
+
+        counts.fill(0);
+        counts['q'] = 7;
+        huffman::build_code_lengths(counts.data(), counts.size(), lengths.data());
+        CHECK(lengths['q'] == 1);
+        CHECK(std::count(lengths.begin(), lengths.end(), 0) == 255);
+
+        std::string one_symbol = "qqqqqqq";
+        tree.build_frequency_table(reinterpret_cast<const uint8_t*>(one_symbol.data()), one_symbol.size());
+        tree.build();
+        CHECK(tree.get_code_lengths() == lengths);
+    }
+
+    TEST_CASE("Length-limited code lengths test") {
+        // fibonacci counts make the unlimited code a chain as deep as the alphabet
+        std::array<uint64_t, 256> counts{};
+        uint64_t previous = 1, current = 1;
+        for (int symbol = 0; symbol < 40; ++symbol) {
+            counts[symbol] = current;
+            uint64_t next = previous + current;
+            previous = current;
+            current = next;
+        }
+
+        std::array<uint8_t, 256> unlimited, limited;
+        huffman::build_code_lengths(counts.data(), counts.size(), unlimited.data());
+        CHECK(*std::max_element(unlimited.begin(), unlimited.end()) == 39);
+
+        for (int limit : {6, 11, 20}) {
+            huffman::build_code_lengths(counts.data(), counts.size(), limited.data(), limit);
+            CHECK(*std::max_element(limited.begin(), limited.end()) == limit);
+
+            // a limited code is still complete, and never beats the unlimited optimum
+            double kraft_sum = 0;
+            uint64_t unlimited_bits = 0, limited_bits = 0;
+            for (int symbol = 0; symbol < 256; ++symbol) {
+                CHECK((counts[symbol] == 0) == (limited[symbol] == 0));
+                kraft_sum += limited[symbol] != 0 ? 1.0 / (uint64_t(1) << limited[symbol]) : 0;
+                unlimited_bits += counts[symbol] * unlimited[symbol];
+                limited_bits += counts[symbol] * limited[symbol];
+            }
+            CHECK(kraft_sum == doctest::Approx(1.0));
+            CHECK(limited_bits >= unlimited_bits);
+        }
+
+        // the unlimited code is kept when it already fits
+        huffman::build_code_lengths(counts.data(), counts.size(), limited.data(), 39);
+        CHECK(limited == unlimited);
+
+        CHECK_THROWS(huffman::build_code_lengths(counts.data(), counts.size(), limited.data(), 5));
+    }
+
     TEST_CASE("One symbol text test") {
         huffman::huffman_tree tree;
         tree.build_frequency_table("../samples/one_symbol_test.txt");
@@ -112,6 +303,33 @@ TEST_SUITE("Huffman-tree test") {
     }
 }
 
+TEST_SUITE("Histogram test") {
+    TEST_CASE("Split counters test") {
+        std::vector<uint8_t> data(1000, 'x');
+        for (size_t i = 0; i < data.size(); i += 3) {
+            data[i] = 0xff;
+        }
+
+        huffman::histogram counts;
+        counts.add(data.data(), data.size());
+        counts.add(data.data(), 13);
+
+        CHECK(counts.get_counts()[0xff] == 334 + 5);
+        CHECK(counts.get_counts()['x'] == 666 + 8);
+        CHECK(counts.get_total() == 1013);
+        CHECK(counts.get_alphabet_power() == 2);
+
+        huffman::huffman_tree tree;
+        tree.build_frequency_table(counts);
+        CHECK(tree.get_chars_frequency()['x'] == 674);
+        CHECK(tree.get_number_of_chars() == 1013);
+
+        counts.clear();
+        CHECK(counts.get_total() == 0);
+        CHECK(counts.get_alphabet_power() == 0);
+    }
+}
+
 TEST_SUITE("Huffman-encoding test") {
     TEST_CASE("Read frequency table test") {
         huffman::huffman_tree tree;
@@ -129,13 +347,1243 @@ TEST_SUITE("Huffman-encoding test") {
     }
 
     TEST_CASE("Compress-decompress 1MB test") {
+        scratch_file archive_file("huffman_test_archive.bin");
+        scratch_file decompressed_file("huffman_test_decompressed.txt");
+        huffman::huffman_tree tree;
+        huffman::huffman_compressor compressor;
+        huffman::huffman_decompressor decompressor;
+
+        compressor.compress_file("../samples/big_text_to_compress.txt", archive_file.get_path());
+        decompressor.decompress_file(archive_file.get_path(), decompressed_file.get_path());
+
+        CHECK(compareFiles("../samples/big_text_to_compress.txt", decompressed_file.get_path()) == true);
+    }
+
+    TEST_CASE("Compress-decompress small blocks test") {
+        scratch_file archive_file("huffman_test_archive.bin");
+        scratch_file decompressed_file("huffman_test_decompressed.txt");
+        huffman::compression_options options;
+        options.block_size = 64 << 10;
+        options.threads = 4;
+        huffman::huffman_compressor compressor(options);
+        huffman::huffman_decompressor decompressor;
+
+        compressor.compress_file("../samples/big_text_to_compress.txt", archive_file.get_path());
+        decompressor.decompress_file(archive_file.get_path(), decompressed_file.get_path());
+
+        CHECK(compareFiles("../samples/big_text_to_compress.txt", decompressed_file.get_path()) == true);
+
+        // a worker of the compressor's own pool may only hand it single blocks
+        std::vector<uint8_t> data(3 * options.block_size, 'x');
+        bool nested_throws = compressor.get_pool()
+                                 .submit([&compressor, &data]() {
+                                     std::stringstream nested;
+                                     compressor.compress(data.data(), 1000, nested);
+                                     try {
+                                         compressor.compress(data.data(), data.size(), nested);
+                                     } catch (const std::runtime_error&) {
+                                         return true;
+                                     }
+                                     return false;
+                                 })
+                                 .get();
+        CHECK(nested_throws);
+
+        options.block_size = 100;
+        CHECK_THROWS(huffman::huffman_compressor{options});
+    }
+
+    TEST_CASE("Compress-decompress interleaved streams test") {
+        scratch_file archive_file("huffman_test_archive.bin");
+        scratch_file decompressed_file("huffman_test_decompressed.txt");
+        huffman::compression_options options;
+        options.streams = 4;
+        huffman::huffman_compressor compressor(options);
+        huffman::huffman_decompressor decompressor;
+
+        compressor.compress_file("../samples/big_text_to_compress.txt", archive_file.get_path());
+        decompressor.decompress_file(archive_file.get_path(), decompressed_file.get_path());
+
+        CHECK(compareFiles("../samples/big_text_to_compress.txt", decompressed_file.get_path()) == true);
+
+        // blocks shorter than the stream count leave some streams empty
+        std::string text = "interleaved streams of uneven length";
+        for (int streams = 2; streams <= huffman::kMaxStreams; ++streams) {
+            for (size_t size = 1; size <= text.size(); ++size) {
+                // blocks this short are cheaper stored, the plan is put back on the code to cover empty streams
+                const uint8_t* data = reinterpret_cast<const uint8_t*>(text.data());
+                huffman::block_plan plan = huffman::plan_block(data, size, 11, streams);
+                if (plan.type == huffman::block_type::stored) {
+                    plan.type = huffman::block_type::interleaved;
+                    huffman::build_code_lengths(plan.counts.get_counts().data(), 256, plan.lengths.data(), 11);
+                    plan.bit_length = huffman::count_encoded_bits(
+                        plan.counts, huffman::build_canonical_codes(plan.lengths)
+                    );
+                }
+                huffman::encoded_block block;
+                huffman::encode_planned(data, size, plan, streams, nullptr, block);
+                CHECK(block.type == (size == 1 ? huffman::block_type::run : huffman::block_type::interleaved));
+
+                std::string decoded(size, '\0');
+                huffman::decode_block(block.type, block.payload.data(), block.payload.size(), decoded.data(), size);
+                CHECK(decoded == text.substr(0, size));
+            }
+        }
+
+        options.streams = huffman::kMaxStreams + 1;
+        CHECK_THROWS(huffman::huffman_compressor{options});
+    }
+
+    TEST_CASE("Compress-decompress limited code length test") {
+        scratch_file archive_file("huffman_test_archive.bin");
+        scratch_file decompressed_file("huffman_test_decompressed.txt");
+        huffman::compression_options options;
+        options.max_code_length = 8;
+        huffman::huffman_compressor compressor(options);
+        huffman::huffman_decompressor decompressor;
+
+        compressor.compress_file("../samples/big_text_to_compress.txt", archive_file.get_path());
+        decompressor.decompress_file(archive_file.get_path(), decompressed_file.get_path());
+
+        CHECK(compareFiles("../samples/big_text_to_compress.txt", decompressed_file.get_path()) == true);
+
+        options.max_code_length = 7;
+        CHECK_THROWS(huffman::huffman_compressor{options});
+    }
+
+    TEST_CASE("Block index test") {
+        scratch_file archive_file("huffman_test_archive.bin");
+        scratch_file decompressed_file("huffman_test_decompressed.txt");
+        huffman::compression_options options;
+        options.block_size = 64 << 10;
+        huffman::huffman_compressor compressor(options);
+        compressor.compress_file("../samples/big_text_to_compress.txt", archive_file.get_path());
+
+        std::ifstream input(archive_file.get_path(), std::ios_base::binary);
+        huffman::binary_io binary_in;
+        huffman::block_index index;
+        REQUIRE(binary_in.read_magic(input));
+        CHECK(binary_in.read_archive_header(input) == options.block_size);
+        REQUIRE(binary_in.read_block_index(input, index));
+
+        CHECK(index.raw_size == 1048575);
+        REQUIRE(index.entries.size() == 16);
+        CHECK(index.entries[0].compressed_offset == huffman::kArchiveHeaderSize);
+        for (size_t i = 0; i < index.entries.size(); ++i) {
+            CHECK(index.entries[i].uncompressed_offset == i * options.block_size);
+            CHECK(index.entries[i].bit_length > 0);
+        }
+        CHECK(index.get_raw_size(15) == options.block_size - 1);
+
+        huffman::decompression_options decompression_options;
+        decompression_options.threads = 3;
+        huffman::huffman_decompressor decompressor(decompression_options);
+        decompressor.decompress_file(archive_file.get_path(), decompressed_file.get_path());
+        CHECK(compareFiles("../samples/big_text_to_compress.txt", decompressed_file.get_path()) == true);
+    }
+
+    TEST_CASE("Range decompress test") {
+        scratch_file archive_file("huffman_test_archive.bin");
+        std::ifstream file("../samples/big_text_to_compress.txt", std::ios_base::binary);
+        std::vector<uint8_t> text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        // small blocks of the same text, most of them repeat blocks reaching back for their table
+        huffman::compression_options options;
+        options.block_size = 4 << 10;
+        options.size_report = nullptr;
+        std::vector<uint8_t> archive;
+        huffman::huffman_compressor(options).compress(text.data(), text.size(), archive);
+
+        huffman::decompression_options decompression_options;
+        decompression_options.threads = 3;
+        decompression_options.size_report = nullptr;
+        huffman::huffman_decompressor decompressor(decompression_options);
+        auto range_matches = [&](uint64_t offset, uint64_t length) {
+            std::vector<uint8_t> slice;
+            decompressor.decompress_range(archive.data(), archive.size(), offset, length, slice);
+            uint64_t end = std::min<uint64_t>(offset + length, text.size());
+            return std::equal(slice.begin(), slice.end(), text.begin() + offset, text.begin() + end) &&
+                   slice.size() == end - offset;
+        };
+        CHECK(range_matches(0, text.size()));
+        CHECK(range_matches(100, 50));                 // inside one block
+        CHECK(range_matches(4095, 2));                 // across a block boundary
+        CHECK(range_matches(500000, 100000));          // many blocks, decoded on the pool
+        CHECK(range_matches(text.size() - 10, 1000));  // clipped to the end
+        CHECK(range_matches(text.size(), 10));
+        CHECK(range_matches(12345, 0));
+        CHECK_THROWS(range_matches(text.size() + 1, 1));
+
+        huffman::huffman_compressor(options).compress_file(
+            "../samples/big_text_to_compress.txt", archive_file.get_path()
+        );
+        std::ostringstream output;
+        decompressor.decompress_range(archive_file.get_path(), 700000, 30000, output);
+        CHECK(output.str() == std::string(text.begin() + 700000, text.begin() + 730000));
+    }
+
+    TEST_CASE("Seek points test") {
+        std::ifstream file("../samples/big_text_to_compress.txt", std::ios_base::binary);
+        std::vector<uint8_t> text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        huffman::compression_options options;
+        options.seek_interval = 4 << 10;
+        options.size_report = nullptr;
+        huffman::decompression_options decompression_options;
+        decompression_options.size_report = nullptr;
+        huffman::huffman_decompressor decompressor(decompression_options);
+
+        // one large block coded as a single stream, then as four interleaved ones
+        for (int streams : {1, 4}) {
+            options.streams = streams;
+            std::vector<uint8_t> archive;
+            huffman::huffman_compressor(options).compress(text.data(), text.size(), archive);
+            CHECK(archive.size() <= huffman::compress_bound(text.size(), options));
+
+            std::istringstream input(std::string(archive.begin(), archive.end()));
+            huffman::binary_io binary_in;
+            huffman::block_index index;
+            REQUIRE(binary_in.read_magic(input));
+            binary_in.read_archive_header(input);
+            REQUIRE(binary_in.read_block_index(input, index));
+            CHECK(index.seek_interval == options.seek_interval);
+            REQUIRE(index.seek_points.size() == 1);
+            CHECK(index.seek_points[0].size() == (text.size() - 1) / options.seek_interval);
+
+            for (auto [offset, length] : std::vector<std::pair<size_t, size_t>>{
+                     {0, 10}, {4096, 1}, {5000, 3000}, {262143, 2}, {700001, 60000}, {text.size() - 5, 5}}) {
+                std::vector<uint8_t> slice;
+                decompressor.decompress_range(archive.data(), archive.size(), offset, length, slice);
+                CHECK(std::equal(slice.begin(), slice.end(), text.begin() + offset, text.begin() + offset + length));
+                CHECK(slice.size() == length);
+            }
+            std::vector<uint8_t> whole;
+            decompressor.decompress(archive.data(), archive.size(), whole);
+            CHECK(whole == text);
+        }
+
+        // points are counted from the start of the stream that codes them
+        huffman::block_plan plan = huffman::plan_block(text.data(), 65536, huffman::kDefaultMaxCodeLength, 1);
+        huffman::choose_table(plan, 1, nullptr, nullptr);
+        REQUIRE(plan.type == huffman::block_type::huffman);
+        huffman::encoded_block block;
+        huffman::encode_planned(text.data(), 65536, plan, 1, nullptr, block, 1024);
+        REQUIRE(block.seek_points.size() == 63);
+        uint64_t bits = 0;
+        for (size_t i = 0; i < 1024; ++i) {
+            bits += plan.lengths[text[i]];
+        }
+        CHECK(block.seek_points[0] == bits);
+        CHECK(block.seek_points.back() < block.bit_length);
+
+        huffman::decode_table table;
+        std::vector<char> decoded(65536);
+        huffman::decode_block_range(
+            block.type, block.payload.data(), block.payload.size(), decoded.data(), 65536, 40000, 40100, table,
+            nullptr, nullptr, 1024, block.seek_points
+        );
+        CHECK(std::equal(decoded.begin() + 40000, decoded.begin() + 40100, text.begin() + 40000));
+        CHECK(!huffman::is_seekable(huffman::block_type::lz));
+
+        options.seek_interval = 100;
+        CHECK_THROWS(huffman::huffman_compressor{options});
+    }
+
+    TEST_CASE("Stream compress-decompress test") {
+        huffman::compression_options options;
+        options.block_size = 100 << 10;
+        options.size_report = nullptr;
+        huffman::decompression_options decompression_options;
+        decompression_options.size_report = nullptr;
+
+        std::ifstream source("../samples/big_text_to_compress.txt", std::ios_base::binary);
+        std::string text((std::istreambuf_iterator<char>(source)), std::istreambuf_iterator<char>());
+
+        std::istringstream input(text);
+        std::stringstream compressed;
+        huffman::huffman_compressor(options).compress_stream(input, compressed);
+
+        std::ostringstream decompressed;
+        huffman::huffman_decompressor(decompression_options).decompress_stream(compressed, decompressed);
+        CHECK(decompressed.str() == text);
+
+        // block sizes no encoder writes are rejected before anything is allocated for them
+        for (size_t field : {size_t(1), size_t(5)}) {
+            std::string hostile = compressed.str();
+            std::memset(&hostile[huffman::kArchiveHeaderSize + field], 0xff, sizeof(uint32_t));
+            std::istringstream hostile_input(hostile);
+            std::ostringstream ignored;
+            CHECK_THROWS_AS(
+                huffman::huffman_decompressor(decompression_options).decompress_stream(hostile_input, ignored),
+                std::runtime_error
+            );
+        }
+    }
+
+    TEST_CASE("Memory compress-decompress test") {
+        scratch_file archive_file("huffman_test_archive.bin");
+        std::ifstream file("../samples/big_text_to_compress.txt", std::ios_base::binary);
+        std::vector<uint8_t> text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        huffman::compression_options options;
+        options.block_size = 64 << 10;
+        options.size_report = nullptr;
+        huffman::huffman_compressor compressor(options);
+        huffman::decompression_options decompression_options;
+        decompression_options.size_report = nullptr;
+        huffman::huffman_decompressor decompressor(decompression_options);
+
+        // same archive as the file path writes
+        std::vector<uint8_t> archive;
+        compressor.compress(text.data(), text.size(), archive);
+        compressor.compress_file("../samples/big_text_to_compress.txt", archive_file.get_path());
+        std::ifstream written(archive_file.get_path(), std::ios_base::binary);
+        std::vector<uint8_t> file_archive((std::istreambuf_iterator<char>(written)), std::istreambuf_iterator<char>());
+        CHECK(file_archive == archive);
+
+        std::vector<uint8_t> buffer(huffman::compress_bound(text.size(), options));
+        size_t archive_size = compressor.compress(text.data(), text.size(), buffer.data(), buffer.size());
+        CHECK(std::equal(archive.begin(), archive.end(), buffer.begin(), buffer.begin() + archive_size));
+        CHECK_THROWS(compressor.compress(text.data(), text.size(), buffer.data(), archive_size - 1));
+
+        std::vector<uint8_t> decoded(text.size());
+        CHECK(decompressor.decompress(archive.data(), archive.size(), decoded.data(), decoded.size()) == text.size());
+        CHECK(decoded == text);
+        CHECK_THROWS(decompressor.decompress(archive.data(), archive.size(), decoded.data(), decoded.size() - 1));
+
+        // growable output is appended to
+        decoded.assign(3, 'x');
+        decompressor.decompress(archive.data(), archive.size(), decoded);
+        CHECK(std::equal(text.begin(), text.end(), decoded.begin() + 3));
+
+        // every byte value in even amounts can't be compressed at all, the bound still holds
+        std::vector<uint8_t> uniform;
+        for (int i = 0; i < 70000; ++i) {
+            uniform.push_back(static_cast<uint8_t>(i * 167));
+        }
+        options.max_code_length = 8;
+        options.streams = huffman::kMaxStreams;
+        archive.resize(huffman::compress_bound(uniform.size(), options));
+        huffman::huffman_compressor uniform_compressor(options);
+        archive_size = uniform_compressor.compress(uniform.data(), uniform.size(), archive.data(), archive.size());
+        archive.resize(archive_size);
+        decoded.clear();
+        decompressor.decompress(archive.data(), archive.size(), decoded);
+        CHECK(decoded == uniform);
+
+        archive.clear();
+        compressor.compress(nullptr, 0, archive);
+        CHECK(archive.size() <= huffman::compress_bound(0, options));
+        decoded.clear();
+        decompressor.decompress(archive.data(), archive.size(), decoded);
+        CHECK(decoded.empty());
+    }
+
+    TEST_CASE("Reused compressor test") {
+        std::ifstream file("../samples/big_text_to_compress.txt", std::ios_base::binary);
+        std::vector<uint8_t> text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        huffman::compression_options options;
+        options.block_size = 4 << 10;
+        options.threads = 2;
+        options.size_report = nullptr;
+        huffman::decompression_options decompression_options;
+        decompression_options.threads = 2;
+        decompression_options.size_report = nullptr;
+        huffman::huffman_compressor compressor(options);
+        huffman::huffman_decompressor decompressor(decompression_options);
+
+        // single and multi-block inputs in turn, the retained state must not leak between calls
+        for (size_t size : {100, 20000, 1, 4096, 50000, 3000}) {
+            const uint8_t* data = text.data() + size * 7;
+            std::vector<uint8_t> archive, fresh_archive, decoded;
+            compressor.compress(data, size, archive);
+            huffman::huffman_compressor(options).compress(data, size, fresh_archive);
+            CHECK(archive == fresh_archive);
+
+            decompressor.decompress(archive.data(), archive.size(), decoded);
+            CHECK(std::equal(decoded.begin(), decoded.end(), data, data + size));
+        }
+    }
+
+    TEST_CASE("Failing input test") {
+        std::ifstream file("../samples/big_text_to_compress.txt", std::ios_base::binary);
+        std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        // hands out the first limit bytes of text, then the read fails
+        class failing_buffer : public std::streambuf {
+        public:
+            failing_buffer(std::string& text, size_t limit) { setg(&text[0], &text[0], &text[0] + limit); }
+
+        protected:
+            int_type underflow() override { throw std::runtime_error("Input failed!"); }
+        };
+
+        huffman::compression_options options;
+        options.block_size = 4 << 10;
+        options.threads = 4;
+        options.size_report = nullptr;
+        huffman::huffman_compressor compressor(options);
+
+        // blocks are still being encoded when the input fails, the compressor has to stay usable after that
+        failing_buffer buffer(text, 100000);
+        std::istream failing(&buffer);
+        failing.exceptions(std::ios_base::badbit);
+        std::ostringstream ignored;
+        CHECK_THROWS_AS(compressor.compress_stream(failing, ignored), std::runtime_error);
+
+        std::istringstream input(text);
+        std::stringstream compressed;
+        compressor.compress_stream(input, compressed);
+        huffman::decompression_options decompression_options;
+        decompression_options.size_report = nullptr;
+        std::ostringstream decompressed;
+        huffman::huffman_decompressor(decompression_options).decompress_stream(compressed, decompressed);
+        CHECK(decompressed.str() == text);
+    }
+
+    TEST_CASE("Stored and run blocks test") {
+        // bytes of a linear congruential generator, nothing a code could shrink
+        std::vector<uint8_t> noise(100000);
+        uint32_t state = 12345;
+        for (uint8_t& byte : noise) {
+            state = state * 1103515245 + 12345;
+            byte = static_cast<uint8_t>(state >> 24);
+        }
+        std::vector<uint8_t> zeros(70000, 0);
+
+        huffman::encoded_block block = huffman::encode_block(noise.data(), noise.size(), 11);
+        CHECK(block.type == huffman::block_type::stored);
+        CHECK(block.payload == noise);
+        block = huffman::encode_block(zeros.data(), zeros.size(), 11, 4);
+        CHECK(block.type == huffman::block_type::run);
+        CHECK(block.payload.size() == 1);
+        std::vector<char> decoded(zeros.size(), 'x');
+        huffman::decode_block(block.type, block.payload.data(), block.payload.size(), decoded.data(), zeros.size());
+        CHECK(std::all_of(decoded.begin(), decoded.end(), [](char c) { return c == 0; }));
+
+        // mixed blocks of an archive each take their own type and keep the previous table across them
+        std::ifstream file("../samples/big_text_to_compress.txt", std::ios_base::binary);
+        std::vector<uint8_t> text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        std::vector<uint8_t> input(text.begin(), text.begin() + 100000);
+        input.insert(input.end(), noise.begin(), noise.end());
+        input.insert(input.end(), zeros.begin(), zeros.end());
+        input.insert(input.end(), text.begin() + 100000, text.begin() + 200000);
+
+        huffman::compression_options options;
+        options.block_size = 16 << 10;
+        options.threads = 2;
+        options.size_report = nullptr;
+        std::vector<uint8_t> archive;
+        huffman::huffman_compressor(options).compress(input.data(), input.size(), archive);
+        CHECK(archive.size() < input.size());
+
+        huffman::decompression_options decompression_options;
+        decompression_options.threads = 2;
+        decompression_options.size_report = nullptr;
+        huffman::huffman_decompressor decompressor(decompression_options);
+        std::vector<uint8_t> indexed;
+        decompressor.decompress(archive.data(), archive.size(), indexed);
+        CHECK(indexed == input);
+        std::istringstream stream(std::string(archive.begin(), archive.end()));
+        std::ostringstream output;
+        decompressor.decompress_stream(stream, output);
+        CHECK(output.str() == std::string(input.begin(), input.end()));
+
+        std::vector<uint8_t> payload = {1, 2};
+        CHECK_THROWS(huffman::decode_block(huffman::block_type::run, payload.data(), 2, decoded.data(), 10));
+    }
+
+    TEST_CASE("Packed tiny alphabet test") {
+        std::string bases = "ACGT";
+        for (int alphabet_power = 2; alphabet_power <= huffman::kMaxPackedAlphabet; ++alphabet_power) {
+            for (size_t size : {4000, 4001, 4002, 4003, 4005}) {
+                std::string text(size, 'A');
+                uint32_t state = size;
+                for (char& c : text) {
+                    state = state * 1103515245 + 12345;
+                    c = bases[(state >> 16) % alphabet_power];
+                }
+                const uint8_t* data = reinterpret_cast<const uint8_t*>(text.data());
+                huffman::encoded_block block = huffman::encode_block(data, size, 11, 2);
+                // even three symbols take fewer bits with a 1, 2, 2 code
+                if (alphabet_power != 3) {
+                    CHECK(block.type == huffman::block_type::packed);
+                    CHECK(block.payload.size() == 1 + alphabet_power + (size * alphabet_power / 2 + 7) / 8);
+                }
+
+                std::string decoded(size, '\0');
+                huffman::decode_block(block.type, block.payload.data(), block.payload.size(), decoded.data(), size);
+                CHECK(decoded == text);
+            }
+        }
+
+        // a skewed alphabet still gets the shorter variable-length code
+        std::string skewed(4000, 'A');
+        for (size_t i = 0; i < skewed.size(); i += 10) {
+            skewed[i] = bases[1 + i % 3];
+        }
+        huffman::encoded_block block =
+            huffman::encode_block(reinterpret_cast<const uint8_t*>(skewed.data()), skewed.size(), 11);
+        CHECK(block.type == huffman::block_type::huffman);
+
+        std::vector<uint8_t> payload = {3, 'A', 'C', 'G', 0x18};
+        std::string decoded(4, '\0');
+        huffman::decode_block(huffman::block_type::packed, payload.data(), 5, decoded.data(), 4);
+        CHECK(decoded == "ACGA");
+
+        // index 3 of a three-symbol block doesn't exist
+        payload[4] = 0xff;
+        CHECK_THROWS(huffman::decode_block(huffman::block_type::packed, payload.data(), 5, decoded.data(), 4));
+        CHECK_THROWS(huffman::decode_block(huffman::block_type::packed, payload.data(), 5, decoded.data(), 5));
+    }
+
+    TEST_CASE("Context model test") {
+        // the previous byte tells a lot here: digits follow '=' and letters follow letters
+        std::string text;
+        for (int i = 0; text.size() < 200000; ++i) {
+            text += "level=info user=" + std::to_string(i * 7919 % 100000) + " path=/api/v" + std::to_string(i % 3) +
+                    "/items status=" + std::to_string(200 + i % 5) + "\n";
+        }
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(text.data());
+
+        huffman::block_plan plan = huffman::plan_block(data, text.size(), huffman::kDefaultMaxCodeLength, 1);
+        size_t order0_size = plan.size;
+        huffman::choose_context_model(plan, data, text.size(), huffman::kDefaultMaxCodeLength);
+        REQUIRE(plan.type == huffman::block_type::context);
+        CHECK(plan.size < order0_size * 3 / 4);
+        CHECK(plan.context_lengths.size() <= huffman::kMaxContextTables);
+
+        huffman::encoded_block block;
+        huffman::encode_planned(data, text.size(), plan, 1, nullptr, block);
+        CHECK(block.payload.size() <= plan.size);
+        std::string decoded(text.size(), '\0');
+        huffman::decode_block(block.type, block.payload.data(), block.payload.size(), decoded.data(), text.size());
+        CHECK(decoded == text);
+
+        // a table index past the table count
+        block.payload[1] = 0xff;
+        CHECK_THROWS(huffman::decode_block(
+            block.type, block.payload.data(), block.payload.size(), decoded.data(), text.size()
+        ));
+
+        // archives mix context blocks with the others, the sample text in small blocks among them
+        std::ifstream file("../samples/big_text_to_compress.txt", std::ios_base::binary);
+        std::string input((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        input += text;
+
+        huffman::compression_options options;
+        options.block_size = 16 << 10;
+        options.threads = 2;
+        options.context_order = 1;
+        options.size_report = nullptr;
+        std::vector<uint8_t> archive, order0_archive;
+        huffman::huffman_compressor(options).compress(
+            reinterpret_cast<const uint8_t*>(input.data()), input.size(), archive
+        );
+        options.context_order = 0;
+        huffman::huffman_compressor(options).compress(
+            reinterpret_cast<const uint8_t*>(input.data()), input.size(), order0_archive
+        );
+        CHECK(archive.size() < order0_archive.size());
+
+        huffman::decompression_options decompression_options;
+        decompression_options.size_report = nullptr;
+        huffman::huffman_decompressor decompressor(decompression_options);
+        std::vector<uint8_t> output;
+        decompressor.decompress(archive.data(), archive.size(), output);
+        CHECK(std::string(output.begin(), output.end()) == input);
+
+        options.context_order = 2;
+        CHECK_THROWS(huffman::huffman_compressor{options});
+    }
+
+    TEST_CASE("Long lz values test") {
+        // a 32-bit match length code with 25 extra bits right after it, past what one refill of the
+        // reader leaves. the matcher never emits such a match, but the format allows it
+        const uint32_t long_match = uint32_t(1) << 25;
+        std::vector<uint8_t> data(1 + long_match, 'a');
+        huffman::block_plan plan;
+        plan.type = huffman::block_type::lz;
+        plan.sequences.push_back({1, long_match, 1});
+        for (int i = 0; i < 8; ++i) {
+            data.push_back('b');
+            plan.sequences.push_back({1, 0, 0});
+        }
+
+        // literals and distances take one bit, a literal run of one takes 8 bits so the match length
+        // code starts on a byte boundary, the match length 37 takes 32 bits
+        for (huffman::code_lengths& lengths : plan.lz_lengths) {
+            lengths.fill(0);
+        }
+        plan.lz_lengths[0]['a'] = plan.lz_lengths[0]['b'] = 1;
+        plan.lz_lengths[1][0] = 1;
+        for (int symbol = 2; symbol <= 8; ++symbol) {
+            plan.lz_lengths[1][symbol] = symbol;
+        }
+        plan.lz_lengths[1][1] = 8;
+        for (int symbol = 0; symbol <= 30; ++symbol) {
+            plan.lz_lengths[2][symbol] = symbol + 1;
+        }
+        plan.lz_lengths[2][37] = plan.lz_lengths[2][38] = 32;
+        plan.lz_lengths[3][0] = plan.lz_lengths[3][1] = 1;
+        plan.bit_length = 1024;
+
+        huffman::encoded_block block;
+        huffman::encode_planned(data.data(), data.size(), plan, 1, nullptr, block);
+        std::vector<char> decoded(data.size());
+        huffman::decode_block(block.type, block.payload.data(), block.payload.size(), decoded.data(), decoded.size());
+        CHECK(std::equal(decoded.begin(), decoded.end(), data.begin()));
+    }
+
+    TEST_CASE("Match finder test") {
+        // a long overlapping match, a match longer than a sequence holds and a literal run longer than one
+        std::string text = "abcabcabcabcabcabcabcabc-";
+        text += "x" + std::string(200000, '0') + "y";
+        uint32_t state = 7;
+        for (int i = 0; i < 70000; ++i) {
+            state = state * 1103515245 + 12345;
+            text += static_cast<char>('a' + (state >> 16) % 26);
+        }
+        text += text.substr(0, 1000);
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(text.data());
+
+        for (int level : {1, 5, huffman::kMaxLzLevel}) {
+            std::vector<huffman::lz_sequence> sequences;
+            huffman::find_matches(data, text.size(), level, sequences);
+            size_t covered = 0;
+            bool valid = true;
+            for (const huffman::lz_sequence& sequence : sequences) {
+                valid &= sequence.literal_length <= huffman::kLzMaxLength;
+                valid &= sequence.match_length <= huffman::kLzMaxLength;
+                valid &= sequence.match_length == 0 || sequence.match_length >= huffman::kLzMinMatch;
+                valid &= sequence.distance <= covered + sequence.literal_length;
+                covered += sequence.literal_length + sequence.match_length;
+            }
+            CHECK(valid);
+            CHECK(covered == text.size());
+
+            huffman::block_plan plan = huffman::plan_block(data, text.size(), huffman::kDefaultMaxCodeLength, 1);
+            size_t order0_size = plan.size;
+            huffman::choose_lz(plan, data, text.size(), level, huffman::kDefaultMaxCodeLength);
+            REQUIRE(plan.type == huffman::block_type::lz);
+            CHECK(plan.size < order0_size * 3 / 4);
+
+            huffman::encoded_block block;
+            huffman::encode_planned(data, text.size(), plan, 1, nullptr, block);
+            CHECK(block.payload.size() <= plan.size);
+            std::string decoded(text.size(), '\0');
+            huffman::decode_block(block.type, block.payload.data(), block.payload.size(), decoded.data(), text.size());
+            CHECK(decoded == text);
+
+            // a truncated payload runs out of sequences or literals
+            CHECK_THROWS(huffman::decode_block(
+                block.type, block.payload.data(), block.payload.size() - 4, decoded.data(), text.size()
+            ));
+        }
+
+        // nothing repeats in a short block
+        std::string unique = "0123456789abcdef";
+        huffman::block_plan plan =
+            huffman::plan_block(reinterpret_cast<const uint8_t*>(unique.data()), unique.size(), 11, 1);
+        huffman::choose_lz(plan, reinterpret_cast<const uint8_t*>(unique.data()), unique.size(), 9, 11);
+        CHECK(plan.type == huffman::block_type::stored);
+
+        std::ifstream file("../samples/big_text_to_compress.txt", std::ios_base::binary);
+        std::string input((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        input += text;
+        huffman::compression_options options;
+        options.block_size = 64 << 10;
+        options.threads = 2;
+        options.lz_level = 3;
+        options.size_report = nullptr;
+        std::vector<uint8_t> archive;
+        huffman::huffman_compressor(options).compress(
+            reinterpret_cast<const uint8_t*>(input.data()), input.size(), archive
+        );
+        huffman::decompression_options decompression_options;
+        decompression_options.size_report = nullptr;
+        std::vector<uint8_t> output;
+        huffman::huffman_decompressor(decompression_options).decompress(archive.data(), archive.size(), output);
+        CHECK(std::string(output.begin(), output.end()) == input);
+
+        options.lz_level = huffman::kMaxLzLevel + 1;
+        CHECK_THROWS(huffman::huffman_compressor{options});
+    }
+
+    TEST_CASE("Repeat table test") {
+        std::ifstream file("../samples/big_text_to_compress.txt", std::ios_base::binary);
+        std::vector<uint8_t> text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        const uint8_t* first = text.data();
+        const uint8_t* second = text.data() + 4096;
+
+        // the next block of the same text reads fine with the codes of the one before
+        huffman::block_plan previous = huffman::plan_block(first, 4096, huffman::kDefaultMaxCodeLength, 2);
+        huffman::block_plan plan = huffman::plan_block(second, 4096, huffman::kDefaultMaxCodeLength, 2);
+        size_t own_size = plan.size;
+        huffman::choose_table(plan, 2, nullptr, &previous.lengths);
+        REQUIRE(plan.type == huffman::block_type::repeat);
+        CHECK(plan.size <= own_size);
+
+        huffman::encoded_block block;
+        huffman::encode_planned(second, 4096, plan, 2, nullptr, block);
+        CHECK(block.type == huffman::block_type::repeat);
+        CHECK(block.payload.size() < own_size);
+
+        huffman::decode_table table;
+        std::vector<char> decoded(4096);
+        huffman::decode_block(
+            block.type, block.payload.data(), block.payload.size(), decoded.data(), 4096, table, nullptr,
+            &previous.lengths
+        );
+        CHECK(std::equal(decoded.begin(), decoded.end(), second));
+        CHECK_THROWS(huffman::decode_block(
+            block.type, block.payload.data(), block.payload.size(), decoded.data(), 4096, table
+        ));
+
+        // the table is only skipped when the block's own one couldn't have won, the choice stays the same
+        bool same_choice = true;
+        int skipped = 0;
+        for (size_t offset = 4096; offset + 1024 <= text.size(); offset += 1024) {
+            const uint8_t* data = text.data() + offset;
+            huffman::block_plan built = huffman::plan_block(data, 1024, huffman::kDefaultMaxCodeLength, 2);
+            huffman::choose_table(built, 2, nullptr, &previous.lengths);
+            huffman::block_plan counted = huffman::count_block(data, 1024);
+            huffman::plan_table(counted, 1024, huffman::kDefaultMaxCodeLength, 2, &previous.lengths);
+            skipped += counted.type == huffman::block_type::repeat;
+            huffman::choose_table(counted, 2, nullptr, &previous.lengths);
+            same_choice = same_choice && counted.type == built.type && counted.size == built.size;
+        }
+        CHECK(same_choice);
+        CHECK(skipped > 0);
+
+        // sequential and indexed decoding both follow the chain of tables across blocks
+        huffman::compression_options options;
+        options.block_size = 4 << 10;
+        options.threads = 3;
+        options.size_report = nullptr;
+        std::vector<uint8_t> archive;
+        huffman::huffman_compressor(options).compress(text.data(), text.size(), archive);
+
+        huffman::decompression_options decompression_options;
+        decompression_options.threads = 3;
+        decompression_options.size_report = nullptr;
+        huffman::huffman_decompressor decompressor(decompression_options);
+        std::vector<uint8_t> indexed;
+        decompressor.decompress(archive.data(), archive.size(), indexed);
+        CHECK(indexed == text);
+
+        std::istringstream input(std::string(archive.begin(), archive.end()));
+        std::ostringstream output;
+        decompressor.decompress_stream(input, output);
+        CHECK(output.str() == std::string(text.begin(), text.end()));
+
+        // the index names the block whose table every block leaves in effect, a range needn't scan back for it
+        huffman::binary_io bin_in;
+        huffman::block_index index;
+        std::istringstream indexed_input(std::string(archive.begin(), archive.end()));
+        REQUIRE(bin_in.read_block_index(indexed_input, index));
+        CHECK(index.has_table_blocks);
+        size_t repeats = 0;
+        for (size_t block = 0; block < index.entries.size(); ++block) {
+            auto type = static_cast<huffman::block_type>(archive[index.entries[block].compressed_offset]);
+            uint32_t table_block = index.entries[block].table_block;
+            if (type == huffman::block_type::huffman || type == huffman::block_type::interleaved) {
+                CHECK(table_block == block);
+            } else {
+                CHECK(table_block == (block == 0 ? huffman::kNoTableBlock : index.entries[block - 1].table_block));
+            }
+            repeats += type == huffman::block_type::repeat;
+        }
+        CHECK(repeats > 0);
+
+        uint64_t offset = text.size() - 10000;
+        std::vector<uint8_t> range;
+        decompressor.decompress_range(archive.data(), archive.size(), offset, 5000, range);
+        CHECK(std::equal(range.begin(), range.end(), text.begin() + offset));
+
+        // an index written without table blocks is still read, the table is found by scanning back
+        std::vector<uint8_t> untabled(archive.begin(), archive.begin() + index.blocks_end + 1);
+        auto append = [&untabled](const auto& value) {
+            const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+            untabled.insert(untabled.end(), bytes, bytes + sizeof(value));
+        };
+        uint64_t index_offset = untabled.size();
+        append(static_cast<uint32_t>(index.entries.size()));
+        append(index.raw_size);
+        for (const huffman::block_index_entry& entry : index.entries) {
+            append(entry.compressed_offset);
+            append(entry.uncompressed_offset);
+            append(entry.bit_length);
+        }
+        append(index_offset);
+        untabled.insert(untabled.end(), huffman::kIndexMagic.begin(), huffman::kIndexMagic.end());
+
+        range.clear();
+        decompressor.decompress_range(untabled.data(), untabled.size(), offset, 5000, range);
+        CHECK(std::equal(range.begin(), range.end(), text.begin() + offset));
+        std::vector<uint8_t> whole;
+        decompressor.decompress(untabled.data(), untabled.size(), whole);
+        CHECK(whole == text);
+    }
+
+    TEST_CASE("Decompress original format test") {
+        scratch_file archive_file("huffman_test_archive.bin");
+        scratch_file decompressed_file("huffman_test_decompressed.txt");
         huffman::huffman_tree tree;
+        huffman::binary_io binary_out;
+        huffman::huffman_decompressor decompressor;
+
+        tree.build_frequency_table("../samples/big_text_to_compress.txt");
+        tree.build();
+        tree.build_table();
+        {
+            std::ofstream output(archive_file.get_path(), std::ios_base::binary);
+            binary_out.write_frequency_table(output, tree);
+            binary_out.write_bits(output, "../samples/big_text_to_compress.txt", tree);
+        }
+        tree.destroy(tree.get_root());
+
+        decompressor.decompress_file(archive_file.get_path(), decompressed_file.get_path());
+        CHECK(compareFiles("../samples/big_text_to_compress.txt", decompressed_file.get_path()) == true);
+    }
+
+    TEST_CASE("Compress-decompress one symbol test") {
+        scratch_file archive_file("huffman_test_archive.bin");
+        scratch_file decompressed_file("huffman_test_decompressed.txt");
         huffman::huffman_compressor compressor;
         huffman::huffman_decompressor decompressor;
 
-        compressor.compress_file("../samples/big_text_to_compress.txt", "../samples/binary_buf.bin");
-        decompressor.decompress_file("../samples/binary_buf.bin", "../samples/big_text_decompressed.txt");
+        compressor.compress_file("../samples/one_symbol_test.txt", archive_file.get_path());
+        decompressor.decompress_file(archive_file.get_path(), decompressed_file.get_path());
+
+        CHECK(compareFiles("../samples/one_symbol_test.txt", decompressed_file.get_path()) == true);
+    }
+}
+
+TEST_SUITE("Canonical code test") {
+    TEST_CASE("Canonical table test") {
+        std::ifstream file("../samples/frequency_table_test.txt", std::ios_base::binary);
+        std::vector<uint8_t> text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        huffman::histogram counts;
+        counts.add(text.data(), text.size());
+        std::array<uint8_t, 256> lengths;
+        huffman::build_code_lengths(counts.get_counts().data(), lengths.size(), lengths.data());
+
+        std::array<huffman::huffman_code, 256> codes = huffman::build_canonical_codes(lengths);
+        const char* symbols = "abcd";
+        for (uint32_t i = 0; i < 4; ++i) {
+            CHECK(codes[static_cast<uint8_t>(symbols[i])].bits == i);
+            CHECK(codes[static_cast<uint8_t>(symbols[i])].length == 2);
+        }
+        CHECK(*std::max_element(lengths.begin(), lengths.end()) == 2);
+    }
+
+    TEST_CASE("Code lengths header test") {
+        std::array<uint8_t, 256> small{};
+        small['a'] = 1;
+        small['b'] = 2;
+        small['c'] = 2;
+
+        std::vector<uint8_t> packed;
+        huffman::pack_code_lengths(small, packed);
+        CHECK(packed.size() == 2 + 3 + 1);
+        CHECK(huffman::packed_code_lengths_size(packed.data()) == packed.size());
+
+        std::array<uint8_t, 256> unpacked;
+        CHECK(huffman::unpack_code_lengths(packed.data(), packed.size(), unpacked) == packed.size());
+        CHECK(unpacked == small);
+
+        std::array<uint8_t, 256> full;
+        full.fill(8);
+        packed.clear();
+        huffman::pack_code_lengths(full, packed);
+        CHECK(packed.size() == 2 + 32 + 128);
+        CHECK(huffman::unpack_code_lengths(packed.data(), packed.size(), unpacked) == packed.size());
+        CHECK(unpacked == full);
+
+        packed.pop_back();
+        CHECK_THROWS(huffman::unpack_code_lengths(packed.data(), packed.size(), unpacked));
+    }
+}
+
+TEST_SUITE("Dictionary test") {
+    TEST_CASE("Train, save and load test") {
+        std::string samples = "the quick brown fox jumps over the lazy dog, again and again and again";
+        huffman::histogram counts;
+        for (int i = 0; i < 16; ++i) {
+            counts.add(reinterpret_cast<const uint8_t*>(samples.data()), samples.size());
+        }
+        huffman::dictionary trained = huffman::dictionary::train(counts, huffman::kDefaultDictionaryCodeLength);
+
+        // every byte value gets a code, the common ones the short codes
+        const std::array<uint8_t, 256>& lengths = trained.get_code_lengths();
+        CHECK(std::count(lengths.begin(), lengths.end(), 0) == 0);
+        CHECK(trained.get_max_code_length() <= huffman::kDefaultDictionaryCodeLength);
+        CHECK(lengths[' '] < lengths['z']);
+        CHECK(lengths['a'] < lengths['#']);
+
+        std::stringstream file;
+        trained.save(file);
+        huffman::dictionary loaded = huffman::dictionary::load(file);
+        CHECK(loaded.get_id() == trained.get_id());
+        CHECK(loaded.get_code_lengths() == lengths);
+
+        std::string corrupted = file.str();
+        corrupted[4] ^= 1;
+        std::stringstream corrupted_file(corrupted);
+        CHECK_THROWS(huffman::dictionary::load(corrupted_file));
+    }
+
+    TEST_CASE("Crafted dictionary test") {
+        // a dictionary file with the right id for whatever lengths it carries
+        auto craft = [](const std::array<uint8_t, 256>& lengths) {
+            uint32_t id = 2166136261u;
+            for (uint8_t length : lengths) {
+                id = (id ^ length) * 16777619u;
+            }
+            std::string file(huffman::kDictionaryMagic.begin(), huffman::kDictionaryMagic.end());
+            file.append(reinterpret_cast<const char*>(&id), sizeof(id));
+            std::vector<uint8_t> packed;
+            huffman::pack_code_lengths(lengths, packed);
+            file.append(packed.begin(), packed.end());
+            return file;
+        };
+
+        std::array<uint8_t, 256> lengths;
+        lengths.fill(8);
+        std::stringstream complete(craft(lengths));
+        CHECK(huffman::dictionary::load(complete).get_max_code_length() == 8);
+
+        lengths[0] = 40;
+        std::stringstream too_long(craft(lengths));
+        CHECK_THROWS(huffman::dictionary::load(too_long));
+        CHECK_THROWS(huffman::build_canonical_codes(lengths));
+
+        lengths.fill(7);
+        std::stringstream over_subscribed(craft(lengths));
+        CHECK_THROWS(huffman::dictionary::load(over_subscribed));
+    }
+
+    TEST_CASE("Compress-decompress with dictionary test") {
+        std::string samples = "the quick brown fox jumps over the lazy dog, again and again and again";
+        std::string message = "a lazy fox jumps over the brown dog";
+        huffman::histogram counts;
+        for (int i = 0; i < 16; ++i) {
+            counts.add(reinterpret_cast<const uint8_t*>(samples.data()), samples.size());
+        }
+        huffman::dictionary trained = huffman::dictionary::train(counts, huffman::kDefaultDictionaryCodeLength);
+        counts.add(reinterpret_cast<const uint8_t*>(message.data()), message.size());
+        huffman::dictionary other = huffman::dictionary::train(counts, huffman::kDefaultDictionaryCodeLength);
+
+        huffman::compression_options options;
+        options.size_report = nullptr;
+        std::vector<uint8_t> plain_archive, archive;
+        huffman::huffman_compressor(options).compress(
+            reinterpret_cast<const uint8_t*>(message.data()), message.size(), plain_archive
+        );
+        options.shared_table = &trained;
+        huffman::huffman_compressor compressor(options);
+        compressor.compress(reinterpret_cast<const uint8_t*>(message.data()), message.size(), archive);
+        CHECK(archive[huffman::kMessageHeaderSize] == static_cast<uint8_t>(huffman::block_type::dictionary));
+        CHECK(archive.size() < plain_archive.size());
+
+        huffman::decompression_options decompression_options;
+        decompression_options.size_report = nullptr;
+        std::vector<uint8_t> decoded;
+        huffman::huffman_decompressor no_dictionary(decompression_options);
+        CHECK_THROWS(no_dictionary.decompress(archive.data(), archive.size(), decoded));
+        decompression_options.shared_table = &other;
+        huffman::huffman_decompressor other_dictionary(decompression_options);
+        CHECK_THROWS(other_dictionary.decompress(archive.data(), archive.size(), decoded));
+
+        decoded.clear();
+        decompression_options.shared_table = &trained;
+        huffman::huffman_decompressor decompressor(decompression_options);
+        decompressor.decompress(archive.data(), archive.size(), decoded);
+        CHECK(std::string(decoded.begin(), decoded.end()) == message);
+
+        // a block unlike the samples keeps its own table
+        std::string digits(5000, '0');
+        for (size_t i = 0; i < digits.size(); ++i) {
+            digits[i] += i * i % 11;
+        }
+        archive.clear();
+        compressor.compress(reinterpret_cast<const uint8_t*>(digits.data()), digits.size(), archive);
+        CHECK(archive[huffman::kMessageHeaderSize] == static_cast<uint8_t>(huffman::block_type::huffman));
+        decoded.clear();
+        decompressor.decompress(archive.data(), archive.size(), decoded);
+        CHECK(std::string(decoded.begin(), decoded.end()) == digits);
+
+        // a message is its magic and one block record, with no block size, end record, index or trailer
+        std::string long_message;
+        while (long_message.size() < 1500) {
+            long_message += message + ", ";
+        }
+        archive.clear();
+        compressor.compress(reinterpret_cast<const uint8_t*>(long_message.data()), long_message.size(), archive);
+        REQUIRE(archive.size() > huffman::kMessageHeaderSize);
+        CHECK(std::equal(huffman::kMessageMagic.begin(), huffman::kMessageMagic.end(), archive.begin()));
+        huffman::block_header header = huffman::parse_block_header(
+            archive.data() + huffman::kMessageHeaderSize, archive.size() - huffman::kMessageHeaderSize
+        );
+        CHECK(archive.size() == huffman::kMessageHeaderSize + huffman::kBlockHeaderSize + header.payload_size);
+
+        decoded.clear();
+        decompressor.decompress(archive.data(), archive.size(), decoded);
+        CHECK(std::string(decoded.begin(), decoded.end()) == long_message);
+        decoded.clear();
+        decompressor.decompress_range(archive.data(), archive.size(), 700, 100, decoded);
+        CHECK(std::string(decoded.begin(), decoded.end()) == long_message.substr(700, 100));
+        size_t past_end = long_message.size() + 1;
+        CHECK_THROWS(decompressor.decompress_range(archive.data(), archive.size(), past_end, 1, decoded));
+        std::stringstream stream_in(std::string(archive.begin(), archive.end())), stream_out;
+        decompressor.decompress_stream(stream_in, stream_out);
+        CHECK(stream_out.str() == long_message);
+
+        // seek points live in the index, so archives that ask for them keep it
+        options.seek_interval = huffman::kMinSeekInterval;
+        std::vector<uint8_t> indexed;
+        huffman::huffman_compressor(options).compress(
+            reinterpret_cast<const uint8_t*>(long_message.data()), long_message.size(), indexed
+        );
+        CHECK(std::equal(huffman::kArchiveMagic.begin(), huffman::kArchiveMagic.end(), indexed.begin()));
+        CHECK(indexed.size() > archive.size() + 50);
+    }
+}
+
+TEST_SUITE("Bit stream test") {
+    TEST_CASE("Bit writer test") {
+        std::vector<huffman::huffman_code> codes = {{1, 1}, {0x5, 3}, {0xabcdef12, 32}, {0, 7}, {0x3ff, 10}, {1, 2}};
+        std::vector<uint8_t> data(16, 0xee);
+
+        huffman::bit_writer writer(data.data());
+        for (const huffman::huffman_code& code : codes) {
+            writer.put(code);
+            writer.flush();
+        }
+        CHECK(writer.finish() == 7);  // 55 bits
+
+        huffman::bit_reader reader(data.data(), data.size());
+        for (const huffman::huffman_code& code : codes) {
+            reader.refill();
+            CHECK(reader.peek(code.length) == code.bits);
+            reader.consume(code.length);
+        }
+        reader.refill();
+        CHECK(reader.peek(1) == 0);  // padding
+    }
+}
+
+TEST_SUITE("File archive test") {
+    TEST_CASE("Checksum test") {
+        std::string check = "123456789";
+        CHECK(huffman::crc32(reinterpret_cast<const uint8_t*>(check.data()), check.size()) == 0xCBF43926);
+        CHECK(huffman::crc32(nullptr, 0) == 0);
+
+        // continuing a checksum gives the same result as taking it at once
+        std::vector<uint8_t> data(1000);
+        for (size_t i = 0; i < data.size(); ++i) {
+            data[i] = static_cast<uint8_t>(i * 7 + i / 13);
+        }
+        uint32_t whole = huffman::crc32(data.data(), data.size());
+        CHECK(huffman::crc32(data.data() + 333, 667, huffman::crc32(data.data(), 333)) == whole);
+    }
+
+    TEST_CASE("Pack, list and extract test") {
+        scratch_file archive_file("huffman_test_archive.bin");
+        std::ifstream input("../samples/big_text_to_compress.txt", std::ios_base::binary);
+        std::string text((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+        std::string small = "abracadabra";
+
+        huffman::compression_options options;
+        options.block_size = 64 << 10;
+        options.size_report = nullptr;
+        {
+            huffman::archive_writer writer(archive_file.get_path(), options);
+            writer.add("small.txt", reinterpret_cast<const uint8_t*>(small.data()), small.size());
+            writer.add("dir/empty", nullptr, 0);
+            writer.add_file("../samples/big_text_to_compress.txt", "dir/big.txt");
+            // many small files are batched, and still come out in the order they were added
+            for (int i = 0; i < 200; ++i) {
+                writer.add_file("../samples/frequency_table_test.txt", "many/" + std::to_string(i));
+            }
+            writer.add("last", reinterpret_cast<const uint8_t*>(small.data()), 4);
+            CHECK_THROWS(writer.add("", nullptr, 0));
+            writer.finish();
+            CHECK_THROWS(writer.add("late", nullptr, 0));
+        }
+
+        huffman::archive_reader reader(archive_file.get_path());
+        const std::vector<huffman::archive_member>& members = reader.get_members();
+        REQUIRE(members.size() == 204);
+        CHECK(members[0].name == "small.txt");
+        CHECK(members[150].name == "many/147");
+        CHECK(members.back().name == "last");
+        CHECK(members[1].original_size == 0);
+        CHECK(members[2].original_size == text.size());
+        CHECK(members[2].compressed_size < text.size());
+        CHECK(reader.find("missing") == nullptr);
+
+        // members are extracted by name, in any order
+        const huffman::archive_member* big = reader.find("dir/big.txt");
+        REQUIRE(big != nullptr);
+        std::ostringstream big_output;
+        reader.extract(*big, big_output);
+        CHECK(big_output.str() == text);
+
+        std::ostringstream small_output, empty_output;
+        reader.extract(members[0], small_output);
+        reader.extract(members[1], empty_output);
+        CHECK(small_output.str() == small);
+        CHECK(empty_output.str().empty());
+
+        std::ifstream small_file("../samples/frequency_table_test.txt", std::ios_base::binary);
+        std::string small_text((std::istreambuf_iterator<char>(small_file)), std::istreambuf_iterator<char>());
+        bool valid = true;
+        for (size_t i = 3; i < 203; ++i) {
+            std::ostringstream output;
+            reader.extract(members[i], output);
+            valid = valid && output.str() == small_text;
+        }
+        CHECK(valid);
+
+        // a member that doesn't match its directory entry is rejected
+        huffman::archive_member wrong = members[0];
+        wrong.checksum ^= 1;
+        std::ostringstream wrong_output;
+        CHECK_THROWS(reader.extract(wrong, wrong_output));
+
+        CHECK_THROWS(huffman::archive_reader("../samples/big_text_to_compress.txt"));
+    }
+}
+
+TEST_SUITE("File output test") {
+    TEST_CASE("Buffered file output test") {
+        scratch_file archive_file("huffman_test_archive.bin");
+        std::string expected;
+        for (bool direct : {false, true}) {
+            huffman::file_output_buffer buffer(archive_file.get_path(), direct, 8192);
+            std::ostream output(&buffer);
+            // single bytes, writes smaller and larger than the buffer, and the position after each
+            expected.clear();
+            bool positions = true;
+            for (int i = 0; i < 3000; ++i) {
+                std::string piece = i % 100 == 0 ? std::string(20000 + i, char('a' + i % 26)) : std::to_string(i);
+                if (i % 7 == 0) {
+                    output.put('#');
+                    expected += '#';
+                }
+                output.write(piece.data(), piece.size());
+                expected += piece;
+                positions = positions && output.tellp() == std::streampos(expected.size());
+            }
+            CHECK(positions);
+            output.flush();
+            CHECK(output.good());
+            buffer.close();
+
+            std::ifstream input(archive_file.get_path(), std::ios_base::binary);
+            std::string written((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+            CHECK(written == expected);
+        }
+
+        CHECK_THROWS(huffman::file_output_buffer("../samples/missing_dir/file.bin"));
+    }
+}
+
+TEST_SUITE("Thread pool test") {
+    TEST_CASE("Nested tasks test") {
+        huffman::thread_pool pool(4);
+        CHECK(pool.get_worker_index() == -1);
+
+        // tasks from outside start in order, so one worker runs them in order
+        huffman::thread_pool single(1);
+        std::vector<int> order;
+        std::vector<std::future<void>> done;
+        for (int i = 0; i < 100; ++i) {
+            done.push_back(single.submit([&order, i]() { order.push_back(i); }));
+        }
+        for (std::future<void>& task : done) {
+            task.get();
+        }
+        std::vector<int> expected(100);
+        std::iota(expected.begin(), expected.end(), 0);
+        CHECK(order == expected);
+
+        // tasks submitted by tasks land on their worker's deque and are stolen by the others
+        std::vector<std::future<std::vector<std::future<int>>>> outer;
+        for (int i = 0; i < 8; ++i) {
+            outer.push_back(pool.submit([&pool, i]() {
+                std::vector<std::future<int>> inner;
+                for (int j = 0; j < 100; ++j) {
+                    inner.push_back(pool.submit([&pool, i, j]() {
+                        int worker = pool.get_worker_index();
+                        return worker >= 0 && worker < 4 ? i * 100 + j : -1;
+                    }));
+                }
+                return inner;
+            }));
+        }
+        bool valid = true;
+        for (int i = 0; i < 8; ++i) {
+            std::vector<std::future<int>> inner = outer[i].get();
+            for (int j = 0; j < 100; ++j) {
+                valid = valid && inner[j].get() == i * 100 + j;
+            }
+        }
+        CHECK(valid);
+
+        CHECK_THROWS(pool.submit([]() { throw std::runtime_error("failed"); }).get());
+    }
+
+    TEST_CASE("Tasks pushed to idle workers test") {
+        // every nested task is stolen by a worker that was waiting for it, the count of pending tasks
+        // has to stay exact or the idle workers never go back to sleep and the pool never stops
+        std::atomic<int> finished{0};
+        {
+            huffman::thread_pool pool(4);
+            for (int round = 0; round < 20; ++round) {
+                std::future<void> outer = pool.submit([&pool, &finished]() {
+                    for (int i = 0; i < 50; ++i) {
+                        pool.submit([&finished]() { finished += 1; });
+                        std::this_thread::sleep_for(std::chrono::microseconds(20));
+                    }
+                });
+                outer.get();
+            }
+        }
+        CHECK(finished == 1000);
+    }
+}
+
+TEST_SUITE("Table decoder test") {
+    TEST_CASE("Codes longer than primary table test") {
+        // unary-like code: symbol i gets i ones followed by a zero, the last one only ones
+        std::map<char, std::string> code_table;
+        std::string prefix;
+        for (char symbol = 'a'; symbol < 'a' + 15; ++symbol) {
+            code_table[symbol] = prefix + "0";
+            prefix += "1";
+        }
+        code_table['z'] = prefix;
+
+        huffman::decode_table table;
+        REQUIRE(table.build(code_table));
+        CHECK(table.get_max_code_length() == 15);
+
+        std::string text = "zazobkzzacz";
+        std::string bits;
+        for (char symbol : text) {
+            bits += code_table[symbol];
+        }
+        std::vector<uint8_t> data((bits.size() + 7) / 8, 0);
+        for (size_t i = 0; i < bits.size(); ++i) {
+            data[i / 8] |= (bits[i] - '0') << (7 - i % 8);
+        }
 
-        CHECK(compareFiles("../samples/big_text_to_compress.txt", "../samples/big_text_decompressed.txt") == true);
+        std::string decoded(text.size(), '\0');
+        table.decode(data.data(), data.size(), decoded.data(), decoded.size());
+        CHECK(decoded == text);
     }
 }